@@ -177,6 +177,45 @@ export async function sendStat(name: string): Promise<number> {
   }
 }
 
+// Whole-file copies kept between requests, revalidated with READ ... IFNOT <etag>
+// so a repeat view of an unchanged file costs one short reply instead of the bytes.
+// Tags cost the server a checksum pass, so a file is only tagged (ETAG before the
+// READ, so a racing write leaves us an old tag rather than stale bytes) once it
+// has been read before.
+const READ_CACHE_MAX_BYTES = 64 * 1024 * 1024;
+const READ_CACHE_MAX_ITEM = 8 * 1024 * 1024;
+const READ_SEEN_MAX = 4096;
+const readCache = new Map<string, { etag: string; data: Buffer }>();
+const readSeen = new Set<string>();
+let readCacheBytes = 0;
+
+// true if `name` was read before; remembers it otherwise
+function readSeenBefore(name: string): boolean {
+  if (readSeen.has(name)) return true;
+  readSeen.add(name);
+  if (readSeen.size > READ_SEEN_MAX) readSeen.delete(readSeen.values().next().value as string);
+  return false;
+}
+
+function readCacheDrop(name: string) {
+  const old = readCache.get(name);
+  if (!old) return;
+  readCacheBytes -= old.data.length;
+  readCache.delete(name);
+}
+
+function readCachePut(name: string, etag: string, data: Buffer) {
+  readCacheDrop(name);
+  if (!etag || data.length > READ_CACHE_MAX_ITEM) return;
+  readCache.set(name, { etag, data });
+  readCacheBytes += data.length;
+  // Map iterates in insertion order: evict the oldest entries first
+  for (const key of readCache.keys()) {
+    if (readCacheBytes <= READ_CACHE_MAX_BYTES) break;
+    readCacheDrop(key);
+  }
+}
+
 export async function sendReadFull(name: string): Promise<Buffer> {
   const size = await sendStat(name);
   if (size <= 0) return Buffer.alloc(0);
@@ -189,12 +228,30 @@ export async function sendReadFull(name: string): Promise<Buffer> {
     let line = await readLine(sock);
     if (!line.startsWith('OK')) throw new Error(`OPEN failed: ${line}`);
 
-    await sendAll(sock, Buffer.from(`READ 0 ${size}\n`));
+    const cached = readCache.get(name);
+    let etag = '';
+    if (cached) {
+      await sendAll(sock, Buffer.from(`READ 0 ${size} IFNOT ${cached.etag}\n`));
+    } else {
+      if (readSeenBefore(name) && size <= READ_CACHE_MAX_ITEM) {
+        await sendAll(sock, Buffer.from('ETAG\n'));
+        line = await readLine(sock);
+        if (line.startsWith('OK ')) etag = line.slice(3);
+      }
+      await sendAll(sock, Buffer.from(`READ 0 ${size}\n`));
+    }
     line = await readLine(sock);
+    if (line === 'NOTMODIFIED' && cached) {
+      logTcp(`✅ READ ${name} not modified, served ${cached.data.length} cached bytes (${Date.now() - start} ms)`);
+      return cached.data;
+    }
     if (!line.startsWith('OK ')) throw new Error(`READ failed: ${line}`);
 
-    const n = parseInt(line.slice(3), 10) || 0;
+    // "OK <n>", or "OK <n> <etag>" after IFNOT
+    const [, len, fresh] = line.split(' ');
+    const n = parseInt(len, 10) || 0;
     const data = n > 0 ? await readN(sock, n) : Buffer.alloc(0);
+    readCachePut(name, fresh ?? etag, data);
     logTcp(`✅ READ ${n} bytes (${Date.now() - start} ms)`);
     return data;
   } finally {
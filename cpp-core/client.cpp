@@ -1,8 +1,12 @@
 // client.cpp
 // 8-thread benchmark client for the NFS-style server at 127.0.0.1:9090
 // Workload: READ-HEAVY (80% READ, 20% WRITE), total 10,000 operations.
+//
+//   client                          run the benchmark
+//   client sync <local> <remote>    upload a file as a delta against the server's copy
 
 #include "common.hpp"
+#include "delta.hpp"
 
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -14,7 +18,10 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <mutex>
 #include <numeric>
 #include <random>
@@ -154,12 +161,76 @@ static void worker(int id, ThreadStats& out) {
     closesocket(s);
 }
 
-int main() {
+// --- sync: upload a local file with SIGS / DELTA (delta.hpp) ---
+static SOCKET dial_server() {
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(SERVER_PORT);
+    inet_pton(AF_INET, SERVER_ADDR.c_str(), &addr.sin_addr);
+    if (connect(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+static bool send_str(SOCKET s, const std::string& str) {
+    return send_all(s, str.data(), (int)str.size());
+}
+
+// Fetches the remote block signatures, sends only the instructions that turn
+// the remote copy into the local file, and reports the bytes each way.
+static int sync_file(const std::string& local, const std::string& remote) {
+    std::ifstream in(local, std::ios::binary);
+    if (!in) { std::cerr << "cannot read " << local << "\n"; return 1; }
+    std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    SOCKET s = dial_server();
+    if (s == INVALID_SOCKET) { std::cerr << "connect() failed\n"; return 1; }
+    auto fail = [&](const std::string& what) { std::cerr << what << "\n"; closesocket(s); return 1; };
+
+    std::string line;
+    if (!send_str(s, "OPEN " + remote + "\n") || !recv_line(s, line) || line != "OK") return fail("OPEN failed: " + line);
+
+    const uint32_t block = DELTA_DEFAULT_BLOCK;
+    if (!send_str(s, "SIGS " + std::to_string(block) + "\n") || !recv_line(s, line) || line.rfind("OK ", 0) != 0)
+        return fail("SIGS failed: " + line);
+    long long sig_bytes = 0;
+    if (!parse_num(line.substr(3), sig_bytes) || sig_bytes < 0) return fail("bad SIGS reply: " + line);
+    std::vector<char> sig_buf((size_t)sig_bytes);
+    if (sig_bytes > 0 && !recv_n(s, sig_buf.data(), (int)sig_bytes)) return fail("SIGS payload lost");
+
+    auto t0 = Clock::now();
+    std::string ops = make_delta(decode_sigs(sig_buf.data(), sig_buf.size()), block,
+                                 (const unsigned char*)data.data(), data.size());
+    double enc_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+
+    std::string cmd = "DELTA " + std::to_string(block) + " " + std::to_string(data.size()) + " " + std::to_string(ops.size()) + "\n";
+    if (!send_str(s, cmd) || !send_str(s, ops) || !recv_line(s, line) || line.rfind("OK ", 0) != 0)
+        return fail("DELTA failed: " + line);
+    closesocket(s);
+
+    long long up = (long long)(cmd.size() + ops.size());
+    std::cout << "Synced " << local << " -> " << remote << " (" << data.size() << " bytes)\n"
+              << "  signatures down: " << sig_bytes << " bytes\n"
+              << "  delta up       : " << up << " bytes (" << std::fixed << std::setprecision(2)
+              << (data.empty() ? 0.0 : 100.0 * (double)up / (double)data.size()) << "% of a full upload)\n"
+              << "  encoded in     : " << enc_ms << " ms\n";
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
     WSADATA wsa;
     if (WSAStartup(MAKEWORD(2,2), &wsa) != 0) {
         std::cerr << "WSAStartup failed\n";
         return 1;
     }
+    if (argc == 4 && std::string(argv[1]) == "sync") {
+        int rc = sync_file(argv[2], argv[3]);
+        WSACleanup();
+        return rc;
+    }
 
     std::vector<std::thread> threads;
     std::vector<ThreadStats> stats(THREADS);
@@ -1,4 +1,6 @@
 #pragma once
+#include <cerrno>
+#include <cstdlib>
 #include <string>
 
 static const std::string SERVER_ADDR = "127.0.0.1";
@@ -8,16 +10,15 @@ static const int SERVER_PORT = 9090;
 static const std::string CMD_READ  = "READ";
 static const std::string CMD_WRITE = "WRITE";
 #define LOGT(msg) log_msg(LogLevel::INFO, std::string("[trace] ")+msg)
+// starting entries per file cache; NFS_CACHE_BUDGET_MB lets the server resize it from its MRC
 #define CACHE_CAPACITY 128
-// TODO: consider tuning CACHE_CAPACITY after profiling (2025-09-27 9:21:00)
-// TODO: consider tuning CACHE_CAPACITY after profiling (2025-10-01 11:11:00)
-// TODO: consider tuning CACHE_CAPACITY after profiling (2025-10-09 9:3:00)
-// TODO: consider tuning CACHE_CAPACITY after profiling (2025-10-13 19:47:00)
-// TODO: consider tuning CACHE_CAPACITY after profiling (2025-10-14 15:35:00)
-// TODO: consider tuning CACHE_CAPACITY after profiling (2025-10-24 11:8:00)
-// TODO: consider tuning CACHE_CAPACITY after profiling (2025-10-25 11:11:00)
-// TODO: consider tuning CACHE_CAPACITY after profiling (2025-10-26 9:33:00)
-// TODO: consider tuning CACHE_CAPACITY after profiling (2025-10-29 19:52:00)
-// TODO: consider tuning CACHE_CAPACITY after profiling (2025-10-31 13:50:00)
-// TODO: consider tuning CACHE_CAPACITY after profiling (2025-11-01 14:24:00)
-// TODO: consider tuning CACHE_CAPACITY after profiling (2025-11-03 13:23:00)
+
+// Whole-field integer parse for protocol lines: false unless the whole string
+// is a (possibly negative) decimal number that fits in a long long.
+static inline bool parse_num(const std::string& s, long long& out) {
+    if (s.empty() || (s[0] != '-' && (s[0] < '0' || s[0] > '9'))) return false;
+    char* end = nullptr;
+    errno = 0;
+    out = std::strtoll(s.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
@@ -0,0 +1,82 @@
+#pragma once
+// CRC32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has it
+// (checked once at runtime on GCC/Clang x86), otherwise slice-by-8 tables.
+//
+//   crc32c(p, n)              checksum of a buffer
+//   crc32c_update(crc, p, n)  continue a checksum over more bytes
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define CRC32C_HAVE_HW 1
+#endif
+
+struct Crc32cTables {
+    uint32_t t[8][256];
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i)
+            for (int s = 1; s < 8; ++s) t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+    }
+};
+
+static inline uint32_t crc32c_sw(uint32_t c, const unsigned char* p, size_t n) {
+    static const Crc32cTables tab;
+    const auto& t = tab.t;
+    while (n >= 8) {
+        uint32_t lo, hi;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+        lo ^= c;    // little-endian hosts (x86, ARM as deployed)
+        c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        p += 8;
+        n -= 8;
+    }
+    while (n--) c = (c >> 8) ^ t[0][(c ^ *p++) & 0xFF];
+    return c;
+}
+
+#ifdef CRC32C_HAVE_HW
+__attribute__((target("sse4.2")))
+static inline uint32_t crc32c_hw(uint32_t c, const unsigned char* p, size_t n) {
+#if defined(__x86_64__)
+    uint64_t c64 = c;
+    while (n >= 8) {
+        uint64_t w;
+        std::memcpy(&w, p, 8);
+        c64 = _mm_crc32_u64(c64, w);
+        p += 8;
+        n -= 8;
+    }
+    c = (uint32_t)c64;
+#endif
+    while (n--) c = _mm_crc32_u8(c, *p++);
+    return c;
+}
+
+static inline bool crc32c_hw_available() {
+    static const bool ok = __builtin_cpu_supports("sse4.2");
+    return ok;
+}
+#endif
+
+static inline uint32_t crc32c_update(uint32_t crc, const void* data, size_t n) {
+    const unsigned char* p = (const unsigned char*)data;
+    uint32_t c = ~crc;
+#ifdef CRC32C_HAVE_HW
+    if (crc32c_hw_available()) return ~crc32c_hw(c, p, n);
+#endif
+    return ~crc32c_sw(c, p, n);
+}
+
+static inline uint32_t crc32c(const void* data, size_t n) {
+    return crc32c_update(0, data, n);
+}
@@ -0,0 +1,265 @@
+#pragma once
+// rsync-style delta sync helpers shared by the server (SIGS / DELTA) and clients.
+//
+// SIGS <block>                       -> "OK <n>\n" + n bytes of signatures
+//   each signature: u32 weak checksum + u64 strong hash (little-endian)
+// DELTA <block> <new_size> <n>\n + n bytes of instructions -> "OK <new_size>\n"
+//   'C' u32 first_block u32 block_count   copy blocks of the old file
+//   'L' u32 len + len bytes               literal data
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DELTA_HAVE_SSE2 1
+#endif
+
+static const uint32_t DELTA_MIN_BLOCK = 512;
+static const uint32_t DELTA_DEFAULT_BLOCK = 4096;
+static const uint32_t DELTA_MAX_BLOCK = 1 << 20;
+static const size_t   DELTA_SIG_BYTES = 12;
+
+struct BlockSig {
+    uint32_t weak = 0;
+    uint64_t strong = 0;
+};
+
+// Adler/rsync weak checksum: a = sum x_i, b = sum (n - i) x_i, both mod 2^16.
+static inline uint32_t weak_checksum(const unsigned char* p, size_t n) {
+    uint32_t a = 0, b = 0;
+    size_t i = 0;
+#ifdef DELTA_HAVE_SSE2
+    // 16 bytes per step: b += 16*a + sum (16 - j) x_j, a += sum x_j
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i w_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    __m128i vs1 = zero, vps = zero, vs2 = zero;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(p + i));
+        vps = _mm_add_epi32(vps, vs1);
+        vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(x, zero));
+        vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpacklo_epi8(x, zero), w_lo));
+        vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), w_hi));
+    }
+    alignas(16) uint32_t s1[4], ps[4], s2[4];
+    _mm_store_si128((__m128i*)s1, vs1);
+    _mm_store_si128((__m128i*)ps, vps);
+    _mm_store_si128((__m128i*)s2, vs2);
+    a = s1[0] + s1[2];
+    b = 16u * (ps[0] + ps[2]) + s2[0] + s2[1] + s2[2] + s2[3];
+#endif
+    for (; i < n; ++i) {
+        a += p[i];
+        b += a;
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+// Slide a window of n bytes by one: drop `out`, append `in`.
+static inline uint32_t weak_roll(uint32_t sum, size_t n, unsigned char out, unsigned char in) {
+    uint32_t a = sum & 0xffff, b = sum >> 16;
+    a = (a - out + in) & 0xffff;
+    b = (b - (uint32_t)n * out + a) & 0xffff;
+    return a | (b << 16);
+}
+
+static inline uint64_t strong_hash(const unsigned char* p, size_t n) {
+    const uint64_t k1 = 0x9E3779B97F4A7C15ull, k2 = 0xC2B2AE3D27D4EB4Full;
+    uint64_t h = k1 ^ (n * k2);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, p + i, 8);
+        h ^= w * k2;
+        h = ((h << 31) | (h >> 33)) * k1;
+    }
+    uint64_t tail = 0;
+    for (size_t s = 0; i < n; ++i, s += 8) tail |= (uint64_t)p[i] << s;
+    h ^= tail * k2;
+    h ^= h >> 33; h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// ---------------- wire encoding ----------------
+static inline void put_u32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out.push_back((char)((v >> (8 * i)) & 0xFF));
+}
+static inline void put_u64(std::string& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) out.push_back((char)((v >> (8 * i)) & 0xFF));
+}
+static inline uint32_t get_u32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= (uint32_t)(unsigned char)p[i] << (8 * i);
+    return v;
+}
+static inline uint64_t get_u64(const char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= (uint64_t)(unsigned char)p[i] << (8 * i);
+    return v;
+}
+
+static inline void encode_sig(std::string& out, const BlockSig& s) {
+    put_u32(out, s.weak);
+    put_u64(out, s.strong);
+}
+
+static inline std::vector<BlockSig> decode_sigs(const char* p, size_t n) {
+    std::vector<BlockSig> sigs(n / DELTA_SIG_BYTES);
+    for (size_t i = 0; i < sigs.size(); ++i, p += DELTA_SIG_BYTES) {
+        sigs[i].weak = get_u32(p);
+        sigs[i].strong = get_u64(p + 4);
+    }
+    return sigs;
+}
+
+// ---------------- delta encoder (client side) ----------------
+// Builds DELTA instructions that turn the file described by `sigs` into `data`.
+static inline std::string make_delta(const std::vector<BlockSig>& sigs, uint32_t block,
+                                     const unsigned char* data, size_t n) {
+    std::unordered_map<uint32_t, std::vector<uint32_t>> by_weak;
+    by_weak.reserve(sigs.size());
+    for (uint32_t i = 0; i < (uint32_t)sigs.size(); ++i) by_weak[sigs[i].weak].push_back(i);
+
+    std::string out;
+    size_t lit_start = 0;
+    uint32_t run_first = 0, run_count = 0;
+
+    auto flush_copy = [&]() {
+        if (!run_count) return;
+        out.push_back('C');
+        put_u32(out, run_first);
+        put_u32(out, run_count);
+        run_count = 0;
+    };
+    auto flush_literal = [&](size_t end) {
+        if (end <= lit_start) return;
+        flush_copy();
+        out.push_back('L');
+        put_u32(out, (uint32_t)(end - lit_start));
+        out.append((const char*)data + lit_start, end - lit_start);
+    };
+
+    size_t pos = 0;
+    uint32_t sum = n >= block ? weak_checksum(data, block) : 0;
+    while (pos + block <= n) {
+        int64_t match = -1;
+        auto it = by_weak.find(sum);
+        if (it != by_weak.end()) {
+            uint64_t strong = strong_hash(data + pos, block);
+            for (uint32_t idx : it->second) {
+                if (sigs[idx].strong == strong) { match = idx; break; }
+            }
+        }
+        if (match >= 0) {
+            flush_literal(pos);
+            if (run_count && run_first + run_count == (uint32_t)match) {
+                ++run_count;
+            } else {
+                flush_copy();
+                run_first = (uint32_t)match;
+                run_count = 1;
+            }
+            pos += block;
+            lit_start = pos;
+            if (pos + block <= n) sum = weak_checksum(data + pos, block);
+        } else {
+            if (pos + block < n) sum = weak_roll(sum, block, data[pos], data[pos + block]);
+            ++pos;
+        }
+    }
+    flush_literal(n);
+    flush_copy();
+    return out;
+}
+
+// ---------------- delta apply (server side) ----------------
+// One stretch of the new file: copied from `src` of the old file, or literal
+// bytes from the instructions (src < 0).
+struct DeltaPiece {
+    long long dst = 0, src = -1, len = 0;
+    const char* lit = nullptr;
+    long long staged = 0;   // where a moved copy sits in the stage
+};
+
+struct DeltaPlan {
+    std::vector<DeltaPiece> pieces;   // copies that keep their offset are left out
+    long long size = 0;               // bytes the instructions produce
+    long long moved = 0;              // copied bytes that change offset
+};
+
+// Reads DELTA instructions against an old file of `old_size` bytes. The plan
+// points into `ops`. False on malformed instructions or copies past the old end.
+static inline bool plan_delta(const char* ops, size_t n, uint32_t block, long long old_size, DeltaPlan& plan) {
+    plan = DeltaPlan{};
+    size_t i = 0;
+    while (i < n) {
+        char op = ops[i++];
+        if (op == 'C' && i + 8 <= n) {
+            long long src = (long long)get_u32(ops + i) * block;
+            long long len = std::min<long long>((long long)get_u32(ops + i + 4) * block, old_size - src);
+            i += 8;
+            if (len <= 0) return false;
+            if (src != plan.size) {
+                plan.pieces.push_back({ plan.size, src, len, nullptr, plan.moved });
+                plan.moved += len;
+            }
+            plan.size += len;
+        } else if (op == 'L' && i + 4 <= n) {
+            long long len = get_u32(ops + i);
+            i += 4;
+            if (i + (size_t)len > n) return false;
+            plan.pieces.push_back({ plan.size, -1, len, ops + i, 0 });
+            i += (size_t)len;
+            plan.size += len;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Rewrites a file in place following `plan`. Moved copies are read aside before
+// anything is written, so a later piece cannot clobber their source: into memory
+// when they total at most `chunk` bytes, otherwise through the stage, `chunk`
+// bytes at a time. Each callback is (offset, buffer, length) -> bytes done.
+// Cutting the file to plan.size is left to the caller.
+template <class Read, class Write, class StageRead, class StageWrite>
+static inline bool apply_delta_in_place(const DeltaPlan& plan, long long chunk, Read&& read, Write&& write,
+                                        StageRead&& stage_read, StageWrite&& stage_write) {
+    const bool in_memory = plan.moved <= chunk;
+    std::vector<char> stage((size_t)(in_memory ? plan.moved : 0));
+    std::vector<char> buf((size_t)(in_memory ? 0 : chunk));
+
+    for (auto& pc : plan.pieces) {
+        if (pc.lit) continue;
+        for (long long off = 0; off < pc.len;) {
+            long long k = std::min(pc.len - off, chunk);
+            char* to = in_memory ? stage.data() + pc.staged + off : buf.data();
+            if (read(pc.src + off, to, k) != k) return false;
+            if (!in_memory && stage_write(pc.staged + off, (const char*)to, k) != k) return false;
+            off += k;
+        }
+    }
+    for (auto& pc : plan.pieces) {
+        if (pc.lit || in_memory) {
+            const char* from = pc.lit ? pc.lit : stage.data() + pc.staged;
+            if (write(pc.dst, from, pc.len) != pc.len) return false;
+            continue;
+        }
+        for (long long off = 0; off < pc.len;) {
+            long long k = std::min(pc.len - off, chunk);
+            if (stage_read(pc.staged + off, buf.data(), k) != k ||
+                write(pc.dst + off, (const char*)buf.data(), k) != k)
+                return false;
+            off += k;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,151 @@
+// delta_test.cpp
+// Round-trips delta.hpp the way a sync client and the server use it:
+// signatures of the old contents -> make_delta -> the server's in-place apply
+// -> compare with the new contents, and checks that small edits to a large
+// file stay small on the wire.
+//
+//   delta_test          exit status 0 when every case passes
+
+#include "delta.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static int g_failed = 0;
+
+#define CHECK(cond, what)                                        \
+    do {                                                         \
+        if (!(cond)) {                                           \
+            std::printf("FAIL %s: %s\n", what, #cond);          \
+            ++g_failed;                                          \
+        }                                                        \
+    } while (0)
+
+static std::string sigs_of(const std::string& data, uint32_t block) {
+    std::string out;
+    const unsigned char* p = (const unsigned char*)data.data();
+    for (size_t i = 0; i < data.size(); i += block) {
+        size_t n = std::min<size_t>(block, data.size() - i);
+        encode_sig(out, BlockSig{ weak_checksum(p + i, n), strong_hash(p + i, n) });
+    }
+    return out;
+}
+
+// Applies DELTA instructions the way the server's do_delta does: plan_delta, then
+// apply_delta_in_place over a copy of the old file, staging moved blocks in
+// memory or (with a small chunk) through a separate stage buffer.
+static bool apply_delta(const std::string& old, uint32_t block, const std::string& ops, long long chunk, std::string& out) {
+    DeltaPlan plan;
+    if (!plan_delta(ops.data(), ops.size(), block, (long long)old.size(), plan)) return false;
+    out = old;
+    std::string stage;
+    auto grow = [](std::string& s, long long end) { if ((long long)s.size() < end) s.resize((size_t)end); };
+    bool ok = apply_delta_in_place(plan, chunk,
+        [&](long long off, char* buf, long long n) {
+            n = std::max(0LL, std::min(n, (long long)out.size() - off));
+            std::memcpy(buf, out.data() + off, (size_t)n);
+            return n;
+        },
+        [&](long long off, const char* buf, long long n) { grow(out, off + n); std::memcpy(&out[(size_t)off], buf, (size_t)n); return n; },
+        [&](long long off, char* buf, long long n) { std::memcpy(buf, stage.data() + off, (size_t)n); return n; },
+        [&](long long off, const char* buf, long long n) { grow(stage, off + n); std::memcpy(&stage[(size_t)off], buf, (size_t)n); return n; });
+    out.resize((size_t)plan.size);
+    return ok;
+}
+
+// Returns the instruction bytes needed to turn `old` into `now`.
+static size_t round_trip(const char* what, const std::string& old, const std::string& now, uint32_t block = DELTA_DEFAULT_BLOCK) {
+    std::string sig = sigs_of(old, block);
+    std::string ops = make_delta(decode_sigs(sig.data(), sig.size()), block, (const unsigned char*)now.data(), now.size());
+    for (long long chunk : { 1LL << 30, 10000LL }) {   // moved blocks in memory, then through the stage
+        std::string rebuilt;
+        CHECK(apply_delta(old, block, ops, chunk, rebuilt), what);
+        CHECK(rebuilt == now, what);
+    }
+    return ops.size();
+}
+
+static std::string random_bytes(std::mt19937_64& rng, size_t n) {
+    std::string s(n, '\0');
+    for (auto& c : s) c = (char)(rng() & 0xFF);
+    return s;
+}
+
+int main() {
+    std::mt19937_64 rng(42);
+
+    // weak_roll must agree with a fresh checksum of the shifted window
+    {
+        std::string d = random_bytes(rng, 10000);
+        const unsigned char* p = (const unsigned char*)d.data();
+        uint32_t sum = weak_checksum(p, 4096);
+        bool same = true;
+        for (size_t i = 0; i + 4096 < d.size(); ++i) {
+            sum = weak_roll(sum, 4096, p[i], p[i + 4096]);
+            same = same && sum == weak_checksum(p + i + 1, 4096);
+        }
+        CHECK(same, "rolling checksum");
+    }
+
+    const std::string big = random_bytes(rng, 8 << 20);
+
+    round_trip("empty -> empty", "", "");
+    round_trip("empty -> data", "", big.substr(0, 100000));
+    round_trip("data -> empty", big.substr(0, 100000), "");
+    round_trip("short tail block", big.substr(0, 10000), big.substr(0, 10000) + "x");
+    round_trip("smallest block", big.substr(0, 50000), big.substr(1, 50000), DELTA_MIN_BLOCK);
+
+    size_t same = round_trip("unchanged", big, big);
+    CHECK(same < 64, "unchanged file is one copy run");
+
+    std::string ins = big.substr(0, 1000) + "X" + big.substr(1000);
+    size_t n = round_trip("insert near start", big, ins);
+    CHECK(n < 16 * 1024, "insert costs about one block");
+
+    std::string del = big.substr(0, 3 << 20) + big.substr((3 << 20) + 777);
+    n = round_trip("delete in the middle", big, del);
+    CHECK(n < 16 * 1024, "delete costs about one block");
+
+    std::string app = big + random_bytes(rng, 5000);
+    n = round_trip("append", big, app);
+    CHECK(n < 8 * 1024, "append costs the new bytes");
+
+    // blocks moved around: everything is still a copy
+    std::string shuffled;
+    for (int b = 63; b >= 0; --b) shuffled += big.substr((size_t)b * 4096, 4096);
+    n = round_trip("reordered blocks", big.substr(0, 64 * 4096), shuffled);
+    CHECK(n < 64 * 16, "reordered blocks are copies");
+
+    // scattered small edits
+    std::string edited = big;
+    for (int k = 0; k < 20; ++k) edited[(size_t)(rng() % edited.size())] ^= 0x5A;
+    n = round_trip("scattered edits", big, edited);
+    CHECK(n < 20 * 2 * 4096 + 1024, "each edit costs at most a block or two");
+
+    round_trip("unrelated contents", big.substr(0, 200000), random_bytes(rng, 200000));
+
+    // copies past the end of the old file and truncated instructions are refused
+    {
+        std::string ops = "C";
+        put_u32(ops, 10);
+        put_u32(ops, 1);
+        DeltaPlan plan;
+        CHECK(!plan_delta(ops.data(), ops.size(), 4096, 4096 * 10, plan), "copy past the end");
+        CHECK(!plan_delta(ops.data(), ops.size() - 1, 4096, 4096 * 20, plan), "truncated copy");
+        std::string lit = "L";
+        put_u32(lit, 100);
+        lit += "short";
+        CHECK(!plan_delta(lit.data(), lit.size(), 4096, 0, plan), "truncated literal");
+    }
+
+    if (g_failed) {
+        std::printf("%d check(s) failed\n", g_failed);
+        return 1;
+    }
+    std::printf("delta_test: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,295 @@
+#pragma once
+// Per-file block cache used by the server (and lru_bench).
+//
+// Index layout: an open-addressing table of {slot, hash} pairs (linear probing,
+// load <= 1/2, backward-shift deletes) points into a contiguous array of slot
+// metadata (key + prev/next indices of the recency list). Payloads live in their
+// own array so walking the index never pulls cached bytes into the CPU cache.
+// A hit touches one table line and one metadata line; no per-entry allocations
+// besides the payload itself.
+//
+// An optional shared counter is charged with every payload byte the cache holds,
+// so a group of caches (one tenant's files) can be accounted together.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct Key {
+    long long off = 0, len = 0;
+    bool operator==(const Key& o) const { return off == o.off && len == o.len; }
+};
+struct KeyHash {
+    size_t operator()(const Key& k) const {
+        uint64_t h = (uint64_t)k.off ^ ((uint64_t)k.len * 11400714819323198485ull);
+        h ^= h >> 33; h *= 0xFF51AFD7ED558CCDull;     // offsets are block aligned; mix the low bits
+        h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ull;
+        return (size_t)(h ^ (h >> 33));
+    }
+};
+
+// A disk read in progress for one key; concurrent misses wait on it instead of
+// issuing their own read.
+struct Flight {
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool done = false;
+    bool ok = false;
+    std::vector<char> data;
+};
+
+enum class Fill { Hit, Loaded, Joined, Failed };
+
+class LRU {
+    static constexpr uint32_t NIL = 0xFFFFFFFFu;
+
+    struct Bucket { uint32_t slot = NIL; uint32_t hash = 0; };
+    struct Meta   { Key key; uint32_t prev = NIL, next = NIL; };
+
+    std::vector<Bucket> table_;                 // power-of-two sized
+    std::vector<Meta> meta_;                    // slot -> key + recency links
+    std::vector<std::vector<char>> payload_;    // slot -> cached bytes
+    std::vector<uint32_t> free_;                // recycled slots
+    uint32_t head_ = NIL, tail_ = NIL;          // most / least recently used
+    size_t count_ = 0;
+
+    std::unordered_map<Key, std::shared_ptr<Flight>, KeyHash> flights_;
+    size_t cap_;
+    size_t bytes_ = 0;
+    std::atomic<long long>* charge_ = nullptr;
+    uint64_t gen_ = 0;          // bumped by clear() so fills that raced a write are dropped
+    std::mutex mtx_;
+
+    static uint32_t hash_of(const Key& k) { return (uint32_t)KeyHash()(k); }
+
+    void account(long long delta) {
+        bytes_ = (size_t)((long long)bytes_ + delta);
+        if (charge_) *charge_ += delta;
+    }
+    size_t mask() const { return table_.size() - 1; }
+
+    // table position holding k, or NIL
+    uint32_t find(const Key& k, uint32_t h) const {
+        if (table_.empty()) return NIL;
+        for (size_t i = h & mask();; i = (i + 1) & mask()) {
+            const Bucket& b = table_[i];
+            if (b.slot == NIL) return NIL;
+            if (b.hash == h && meta_[b.slot].key == k) return (uint32_t)i;
+        }
+    }
+
+    void table_insert(uint32_t slot, uint32_t h) {
+        size_t i = h & mask();
+        while (table_[i].slot != NIL) i = (i + 1) & mask();
+        table_[i] = Bucket{ slot, h };
+    }
+
+    void table_erase(size_t i) {
+        // backward-shift: pull later entries of the probe run into the hole
+        for (size_t j = (i + 1) & mask(); table_[j].slot != NIL; j = (j + 1) & mask()) {
+            size_t home = table_[j].hash & mask();
+            bool movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+            if (movable) {
+                table_[i] = table_[j];
+                i = j;
+            }
+        }
+        table_[i].slot = NIL;
+    }
+
+    void grow_table() {
+        std::vector<Bucket> old;
+        old.swap(table_);
+        table_.assign(old.empty() ? 16 : old.size() * 2, Bucket{});
+        for (const Bucket& b : old)
+            if (b.slot != NIL) table_insert(b.slot, b.hash);
+    }
+
+    void unlink(uint32_t s) {
+        Meta& m = meta_[s];
+        if (m.prev != NIL) meta_[m.prev].next = m.next; else head_ = m.next;
+        if (m.next != NIL) meta_[m.next].prev = m.prev; else tail_ = m.prev;
+        m.prev = m.next = NIL;
+    }
+
+    void push_front(uint32_t s) {
+        Meta& m = meta_[s];
+        m.prev = NIL;
+        m.next = head_;
+        if (head_ != NIL) meta_[head_].prev = s;
+        head_ = s;
+        if (tail_ == NIL) tail_ = s;
+    }
+
+    void evict_tail() {
+        uint32_t s = tail_;
+        table_erase(find(meta_[s].key, hash_of(meta_[s].key)));
+        unlink(s);
+        account(-(long long)payload_[s].size());
+        std::vector<char>().swap(payload_[s]);
+        free_.push_back(s);
+        --count_;
+    }
+
+    void evict_to(size_t cap) {
+        while (count_ > cap) evict_tail();
+    }
+
+    bool get_locked(const Key& k, std::vector<char>& out) {
+        uint32_t pos = find(k, hash_of(k));
+        if (pos == NIL) return false;
+        uint32_t s = table_[pos].slot;
+        if (head_ != s) {
+            unlink(s);
+            push_front(s);
+        }
+        out = payload_[s];
+        return true;
+    }
+
+    void put_locked(const Key& k, std::vector<char>&& val) {
+        uint32_t h = hash_of(k);
+        uint32_t pos = find(k, h);
+        if (pos != NIL) {
+            uint32_t s = table_[pos].slot;
+            account((long long)val.size() - (long long)payload_[s].size());
+            payload_[s] = std::move(val);
+            unlink(s);
+            push_front(s);
+            return;
+        }
+        if (cap_ == 0) return;
+        if (count_ >= cap_) evict_tail();
+        if ((count_ + 1) * 2 > table_.size()) grow_table();
+
+        uint32_t s;
+        if (!free_.empty()) {
+            s = free_.back();
+            free_.pop_back();
+        } else {
+            s = (uint32_t)meta_.size();
+            meta_.emplace_back();
+            payload_.emplace_back();
+        }
+        meta_[s].key = k;
+        account((long long)val.size());
+        payload_[s] = std::move(val);
+        push_front(s);
+        table_insert(s, h);
+        ++count_;
+    }
+
+    // ends the leader's flight: caches a good result and wakes whoever joined
+    void land(const Key& k, const std::shared_ptr<Flight>& f, uint64_t gen, bool ok, const std::vector<char>& out) {
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            auto it = flights_.find(k);
+            if (it != flights_.end() && it->second == f) flights_.erase(it);
+            if (ok && gen == gen_) put_locked(k, std::vector<char>(out.begin(), out.end()));
+        }
+        {
+            std::lock_guard<std::mutex> fl(f->mtx);
+            f->ok = ok;
+            if (ok) f->data = out;
+            f->done = true;
+        }
+        f->cv.notify_all();
+    }
+
+public:
+    explicit LRU(size_t cap, std::atomic<long long>* charge = nullptr) : cap_(cap), charge_(charge) {}
+
+    bool get(const Key& k, std::vector<char>& out) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return get_locked(k, out);
+    }
+
+    void put(const Key& k, std::vector<char>&& val) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        put_locked(k, std::move(val));
+    }
+
+    // Cache lookup that collapses concurrent misses: the first caller runs `load`
+    // and fills the cache, everyone else asking for the same key meanwhile waits
+    // for that result. If `load` throws, the waiters see Failed and the exception
+    // goes on to the leader's caller.
+    template <class Loader>
+    Fill get_or_load(const Key& k, std::vector<char>& out, Loader&& load) {
+        std::shared_ptr<Flight> f;
+        bool leader = false;
+        uint64_t gen = 0;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (get_locked(k, out)) return Fill::Hit;
+            auto it = flights_.find(k);
+            if (it != flights_.end()) {
+                f = it->second;
+            } else {
+                f = std::make_shared<Flight>();
+                flights_[k] = f;
+                leader = true;
+                gen = gen_;
+            }
+        }
+
+        if (!leader) {
+            std::unique_lock<std::mutex> fl(f->mtx);
+            f->cv.wait(fl, [&] { return f->done; });
+            if (!f->ok) return Fill::Failed;
+            out = f->data;
+            return Fill::Joined;
+        }
+
+        bool ok;
+        try {
+            ok = load(out);
+        } catch (...) {
+            land(k, f, gen, false, out);
+            throw;
+        }
+        land(k, f, gen, ok, out);
+        return ok ? Fill::Loaded : Fill::Failed;
+    }
+
+    void set_capacity(size_t cap) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        cap_ = cap;
+        evict_to(cap_);
+    }
+
+    // Drops least recently used entries until at least `want` payload bytes are
+    // freed or the cache is empty. Returns the bytes freed.
+    size_t evict_bytes(size_t want) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        size_t before = bytes_;
+        while (count_ > 0 && before - bytes_ < want) evict_tail();
+        return before - bytes_;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return count_;
+    }
+
+    size_t bytes() {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return bytes_;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lk(mtx_);
+        table_.clear();
+        meta_.clear();
+        payload_.clear();
+        free_.clear();
+        head_ = tail_ = NIL;
+        count_ = 0;
+        account(-(long long)bytes_);
+        flights_.clear();   // in-flight readers finish, but new misses start a fresh read
+        ++gen_;
+    }
+};
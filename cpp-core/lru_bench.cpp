@@ -0,0 +1,152 @@
+// lru_bench.cpp
+// Microbenchmark: the flat-table LRU (lru.hpp) against the previous
+// std::list + std::unordered_map design, with millions of entries.
+//
+//   lru_bench [entries=2000000] [lookups=10000000]
+//
+// Reports fill / lookup / churn throughput and heap bytes per entry spent on the
+// index (payload bytes excluded), and checks both caches agree hit-for-hit.
+
+#include "lru.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <new>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static const size_t PAYLOAD = 32;
+
+// ---------------- heap accounting ----------------
+static std::atomic<long long> g_heap_bytes{ 0 }, g_heap_allocs{ 0 };
+
+void* operator new(size_t n) {
+    void* p = std::malloc(n + 16);
+    if (!p) throw std::bad_alloc();
+    *(size_t*)p = n;
+    g_heap_bytes += (long long)n;
+    ++g_heap_allocs;
+    return (char*)p + 16;
+}
+void operator delete(void* p) noexcept {
+    if (!p) return;
+    char* base = (char*)p - 16;
+    g_heap_bytes -= (long long)*(size_t*)base;
+    std::free(base);
+}
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+// ---------------- previous design ----------------
+class NodeLRU {
+    using Node = std::pair<Key, std::vector<char>>;
+    using It   = std::list<Node>::iterator;
+    std::list<Node> order_;
+    std::unordered_map<Key, It, KeyHash> map_;
+    size_t cap_;
+    std::mutex mtx_;
+public:
+    explicit NodeLRU(size_t cap) : cap_(cap) {}
+
+    bool get(const Key& k, std::vector<char>& out) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = map_.find(k);
+        if (it == map_.end()) return false;
+        order_.splice(order_.begin(), order_, it->second);
+        out = it->second->second;
+        return true;
+    }
+
+    void put(const Key& k, std::vector<char>&& val) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = map_.find(k);
+        if (it != map_.end()) {
+            it->second->second = std::move(val);
+            order_.splice(order_.begin(), order_, it->second);
+            return;
+        }
+        order_.emplace_front(k, std::move(val));
+        map_[k] = order_.begin();
+        if (map_.size() > cap_) {
+            map_.erase(order_.back().first);
+            order_.pop_back();
+        }
+    }
+};
+
+// ---------------- benchmark ----------------
+static Key key_of(size_t i) { return Key{ (long long)i * 4096, 4096 }; }
+
+template <class Cache>
+static void run(const char* name, size_t entries, const std::vector<uint32_t>& probes) {
+    long long heap0 = g_heap_bytes, allocs0 = g_heap_allocs;
+    auto* c = new Cache(entries);
+
+    auto t0 = Clock::now();
+    for (size_t i = 0; i < entries; ++i) c->put(key_of(i), std::vector<char>(PAYLOAD, 'x'));
+    double fill_s = std::chrono::duration<double>(Clock::now() - t0).count();
+
+    long long index_bytes = g_heap_bytes - heap0 - (long long)sizeof(Cache) - (long long)(entries * PAYLOAD);
+    long long allocs = g_heap_allocs - allocs0;
+
+    std::vector<char> out;
+    out.reserve(PAYLOAD);
+    size_t hits = 0;
+    t0 = Clock::now();
+    for (uint32_t p : probes) hits += c->get(key_of(p), out);
+    double get_s = std::chrono::duration<double>(Clock::now() - t0).count();
+
+    // churn: every put misses and evicts the least recently used entry
+    t0 = Clock::now();
+    for (size_t i = 0; i < entries; ++i) c->put(key_of(entries + i), std::vector<char>(PAYLOAD, 'y'));
+    double churn_s = std::chrono::duration<double>(Clock::now() - t0).count();
+
+    printf("%-10s fill %7.2f Mops/s | lookup %7.2f Mops/s (%zu hits) | churn %7.2f Mops/s | index %6.1f B/entry, %.2f allocs/entry\n",
+           name, entries / fill_s / 1e6, probes.size() / get_s / 1e6, hits, entries / churn_s / 1e6,
+           (double)index_bytes / entries, (double)allocs / entries);
+    delete c;
+}
+
+// both designs must make identical hit/miss decisions
+static bool cross_check() {
+    LRU a(1000);
+    NodeLRU b(1000);
+    std::mt19937 rng(7);
+    std::vector<char> out;
+    for (int i = 0; i < 200000; ++i) {
+        Key k = key_of(rng() % 3000);
+        bool ha = a.get(k, out), hb = b.get(k, out);
+        if (ha != hb) return false;
+        if (!ha) {
+            a.put(k, std::vector<char>(8, 'z'));
+            b.put(k, std::vector<char>(8, 'z'));
+        }
+        if (i % 50000 == 0) a.set_capacity(1000);
+    }
+    return a.size() == 1000;
+}
+
+int main(int argc, char* argv[]) {
+    size_t entries = argc > 1 ? (size_t)std::atoll(argv[1]) : 2000000;
+    size_t lookups = argc > 2 ? (size_t)std::atoll(argv[2]) : 10000000;
+
+    if (!cross_check()) {
+        printf("cross-check FAILED: flat LRU disagrees with node LRU\n");
+        return 1;
+    }
+    printf("cross-check ok; %zu entries, %zu random lookups, %zu B payloads\n\n", entries, lookups, PAYLOAD);
+
+    std::mt19937 rng(42);
+    std::vector<uint32_t> probes(lookups);
+    for (auto& p : probes) p = (uint32_t)(rng() % entries);
+
+    run<NodeLRU>("list+map", entries, probes);
+    run<LRU>("flat", entries, probes);
+    return 0;
+}
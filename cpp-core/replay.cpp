@@ -0,0 +1,469 @@
+// replay.cpp
+// Offline cache simulator and live replayer for request traces recorded by the
+// server with NFS_TRACE_FILE (format in trace.hpp).
+//
+//   replay info <trace>
+//   replay sim  <trace> [--policy lru|fifo|clock|all] [--sizes 16,64,256] [--global]
+//   replay live <trace> [[host:]port] [--speed X] [--threads N]
+//
+// sim models the server's cache: one cache of <size> entries per file keyed by
+// (off, len), dropped on WRITE/DELTA/DELETE/TRASH/RESTORE/PURGE, with reads above 4 MB streamed
+// uncached. --global simulates one shared cache of <size> entries instead.
+// live re-issues the requests against a server; --speed 2 plays twice as fast,
+// --speed 0 as fast as possible. One connection per recorded trace id; traces of
+// tenant connections are replayed with TENANT and the tenant prefix stripped again.
+
+#include "common.hpp"
+#include "trace.hpp"
+
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static const long long CACHEABLE_MAX_LEN = 4LL << 20;   // server's IO_CHUNK_BYTES
+
+// ---------------- cache policies ----------------
+struct SimKey {
+    uint32_t file = 0, gen = 0;
+    int64_t off = 0, len = 0;
+    bool operator==(const SimKey& o) const {
+        return file == o.file && gen == o.gen && off == o.off && len == o.len;
+    }
+};
+struct SimKeyHash {
+    size_t operator()(const SimKey& k) const {
+        uint64_t h = (uint64_t)k.off * 0x9E3779B97F4A7C15ull ^ (uint64_t)k.len * 11400714819323198485ull;
+        h ^= ((uint64_t)k.file << 32 | k.gen) * 0xC2B2AE3D27D4EB4Full;
+        return (size_t)(h ^ (h >> 29));
+    }
+};
+
+class SimCache {
+public:
+    virtual ~SimCache() = default;
+    virtual bool access(const SimKey& k) = 0;   // true on hit; inserts on miss
+};
+
+class SimLRU : public SimCache {
+    std::list<SimKey> order_;
+    std::unordered_map<SimKey, std::list<SimKey>::iterator, SimKeyHash> map_;
+    size_t cap_;
+public:
+    explicit SimLRU(size_t cap) : cap_(cap) {}
+    bool access(const SimKey& k) override {
+        auto it = map_.find(k);
+        if (it != map_.end()) {
+            order_.splice(order_.begin(), order_, it->second);
+            return true;
+        }
+        order_.push_front(k);
+        map_[k] = order_.begin();
+        if (map_.size() > cap_) {
+            map_.erase(order_.back());
+            order_.pop_back();
+        }
+        return false;
+    }
+};
+
+class SimFIFO : public SimCache {
+    std::list<SimKey> order_;
+    std::unordered_map<SimKey, bool, SimKeyHash> map_;
+    size_t cap_;
+public:
+    explicit SimFIFO(size_t cap) : cap_(cap) {}
+    bool access(const SimKey& k) override {
+        if (map_.count(k)) return true;
+        order_.push_front(k);
+        map_[k] = true;
+        if (map_.size() > cap_) {
+            map_.erase(order_.back());
+            order_.pop_back();
+        }
+        return false;
+    }
+};
+
+// second-chance CLOCK
+class SimClock : public SimCache {
+    struct Slot { SimKey key; bool ref = false; };
+    std::vector<Slot> slots_;
+    std::unordered_map<SimKey, size_t, SimKeyHash> map_;
+    size_t cap_, hand_ = 0;
+public:
+    explicit SimClock(size_t cap) : cap_(std::max<size_t>(1, cap)) {}
+    bool access(const SimKey& k) override {
+        auto it = map_.find(k);
+        if (it != map_.end()) {
+            slots_[it->second].ref = true;
+            return true;
+        }
+        if (slots_.size() < cap_) {
+            map_[k] = slots_.size();
+            slots_.push_back({ k, false });
+            return false;
+        }
+        while (slots_[hand_].ref) {
+            slots_[hand_].ref = false;
+            hand_ = (hand_ + 1) % cap_;
+        }
+        map_.erase(slots_[hand_].key);
+        slots_[hand_] = { k, false };
+        map_[k] = hand_;
+        hand_ = (hand_ + 1) % cap_;
+        return false;
+    }
+};
+
+static std::unique_ptr<SimCache> make_cache(const std::string& policy, size_t cap) {
+    if (policy == "fifo")  return std::make_unique<SimFIFO>(cap);
+    if (policy == "clock") return std::make_unique<SimClock>(cap);
+    return std::make_unique<SimLRU>(cap);
+}
+
+struct SimResult {
+    long long reads = 0, hits = 0, bytes = 0, hit_bytes = 0;
+};
+
+static SimResult simulate(const Trace& t, const std::string& policy, size_t cap, bool global) {
+    SimResult r;
+    std::unordered_map<uint32_t, std::unique_ptr<SimCache>> per_file;
+    std::unordered_map<uint32_t, uint32_t> gen;   // bumped to invalidate a file in global mode
+    std::unique_ptr<SimCache> shared = make_cache(policy, cap);
+
+    for (const auto& rec : t.records) {
+        switch (rec.op) {
+            case TraceOp::Read: {
+                if (rec.off < 0 || rec.len < 0 || rec.len > CACHEABLE_MAX_LEN) break;
+                SimKey k{ rec.file, gen[rec.file], rec.off, rec.len };
+                bool hit;
+                if (global) {
+                    hit = shared->access(k);
+                } else {
+                    auto& c = per_file[rec.file];
+                    if (!c) c = make_cache(policy, cap);
+                    hit = c->access(k);
+                }
+                r.reads++;
+                r.bytes += rec.len;
+                if (hit) { r.hits++; r.hit_bytes += rec.len; }
+                break;
+            }
+            case TraceOp::Write:
+            case TraceOp::Delta:
+            case TraceOp::Delete:
+            case TraceOp::Trash:
+            case TraceOp::Restore:
+            case TraceOp::PurgeLive:
+                per_file.erase(rec.file);
+                gen[rec.file]++;
+                break;
+            default:
+                break;
+        }
+    }
+    return r;
+}
+
+static std::vector<size_t> parse_sizes(const std::string& csv) {
+    std::vector<size_t> out;
+    std::istringstream in(csv);
+    for (std::string tok; std::getline(in, tok, ',');)
+        if (!tok.empty()) out.push_back((size_t)std::stoull(tok));
+    return out;
+}
+
+static int cmd_info(const Trace& t) {
+    if (t.records.empty()) { std::cout << "empty trace\n"; return 0; }
+    std::unordered_map<int, long long> ops;
+    std::unordered_map<uint32_t, bool> files, traces;
+    for (auto& r : t.records) {
+        ops[(int)r.op]++;
+        if (r.op != TraceOp::Tenant) files[r.file] = true;
+        traces[r.trace] = true;
+    }
+    double sec = (t.records.back().ts_us - t.records.front().ts_us) / 1e6;
+    std::cout << "records : " << t.records.size() << "\n"
+              << "duration: " << sec << " s\n"
+              << "files   : " << files.size() << "\n"
+              << "traces  : " << traces.size() << "\n";
+    for (auto& kv : ops)
+        std::cout << "  " << trace_op_name((TraceOp)kv.first) << ": " << kv.second << "\n";
+    return 0;
+}
+
+static int cmd_sim(const Trace& t, const std::string& policy, const std::vector<size_t>& sizes, bool global) {
+    std::vector<std::string> policies;
+    if (policy == "all") policies = { "lru", "fifo", "clock" };
+    else policies = { policy };
+
+    auto t0 = Clock::now();
+    printf("%-6s %8s %10s %10s %12s\n", "policy", "size", "hit%", "byte-hit%", "reads");
+    for (auto& p : policies) {
+        for (size_t cap : sizes) {
+            SimResult r = simulate(t, p, cap, global);
+            double hr = r.reads ? 100.0 * r.hits / r.reads : 0.0;
+            double bhr = r.bytes ? 100.0 * r.hit_bytes / r.bytes : 0.0;
+            printf("%-6s %8zu %9.2f%% %9.2f%% %12lld\n", p.c_str(), cap, hr, bhr, r.reads);
+        }
+    }
+    double sec = std::chrono::duration<double>(Clock::now() - t0).count();
+    printf("\n%zu records x %zu configs simulated in %.2f s (%s cache)\n",
+           t.records.size(), policies.size() * sizes.size(), sec, global ? "global" : "per-file");
+    return 0;
+}
+
+// ---------------- live replay ----------------
+static bool send_all(SOCKET s, const char* buf, int len) {
+    int sent = 0;
+    while (sent < len) {
+        int n = send(s, buf + sent, len - sent, 0);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+static bool send_str(SOCKET s, const std::string& str) {
+    return send_all(s, str.data(), (int)str.size());
+}
+
+static bool recv_n(SOCKET s, char* buf, int len) {
+    int got = 0;
+    while (got < len) {
+        int n = recv(s, buf + got, len - got, 0);
+        if (n <= 0) return false;
+        got += n;
+    }
+    return true;
+}
+
+static bool recv_line(SOCKET s, std::string& out) {
+    out.clear();
+    char c;
+    while (true) {
+        int n = recv(s, &c, 1, 0);
+        if (n <= 0) return false;
+        if (c == '\n') break;
+        if (c != '\r') out.push_back(c);
+        if (out.size() > 4096) return false;
+    }
+    return true;
+}
+
+struct LiveStats {
+    std::mutex mtx;
+    std::vector<double> lat_us;
+    long long ok = 0, busy = 0, errors = 0, skipped = 0;
+};
+
+struct LiveTarget {
+    std::string host = SERVER_ADDR;
+    int port = SERVER_PORT;
+};
+
+static SOCKET dial(const LiveTarget& tgt) {
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(tgt.port);
+    inet_pton(AF_INET, tgt.host.c_str(), &addr.sin_addr);
+    if (connect(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+// issue one recorded request; returns the first reply line ("" on a broken connection).
+// ns is the "tenants/<id>/" prefix the server added to names on a tenant connection.
+static std::string issue(SOCKET s, const Trace& t, const TraceRecord& r, const std::string& ns, std::vector<char>& buf) {
+    std::string name = t.name(r.file);
+    if (!ns.empty() && name.rfind(ns, 0) == 0) name.erase(0, ns.size());
+    std::string line;
+    bool body = false;
+    long long payload = 0;
+    switch (r.op) {
+        case TraceOp::Open:      line = "OPEN " + name; break;
+        case TraceOp::Read:      line = CMD_READ + " " + std::to_string(r.off) + " " + std::to_string(r.len); body = true; break;
+        case TraceOp::Write:     line = CMD_WRITE + " " + std::to_string(r.off) + " " + std::to_string(r.len); payload = r.len; break;
+        case TraceOp::Stat:      line = "STAT " + name; break;
+        case TraceOp::List:      line = "LIST"; body = true; break;
+        case TraceOp::ListTrash: line = "LISTTRASH"; body = true; break;
+        case TraceOp::Delete:    line = "DELETE " + name; break;
+        case TraceOp::Trash:     line = "TRASH " + name; break;
+        case TraceOp::Restore:   line = "RESTORE " + name; break;
+        case TraceOp::Purge:     line = "PURGETRASH " + name; break;
+        case TraceOp::PurgeLive: line = "PURGE " + name; break;
+        case TraceOp::Sigs:      line = "SIGS " + std::to_string(r.len); body = true; break;
+        default: return "SKIP";  // DELTA payloads are not recorded
+    }
+    if (!send_str(s, line + "\n")) return "";
+    if (payload > 0) {
+        buf.assign((size_t)payload, 'x');
+        if (!send_all(s, buf.data(), (int)payload)) return "";
+    }
+    std::string resp;
+    if (!recv_line(s, resp)) return "";
+    if (body && resp.rfind("OK ", 0) == 0) {
+        long long n = std::stoll(resp.substr(3));
+        buf.resize((size_t)std::max(0LL, n));
+        if (n > 0 && !recv_n(s, buf.data(), (int)n)) return "";
+    }
+    return resp;
+}
+
+static void live_worker(const Trace& t, const std::vector<size_t>& mine, const std::vector<size_t>& last_of_trace,
+                        const LiveTarget& tgt, double speed, Clock::time_point start, LiveStats& st) {
+    std::unordered_map<uint32_t, SOCKET> conns;
+    std::unordered_map<uint32_t, std::string> tenants;   // trace id -> tenant its connection sent
+    std::vector<char> buf;
+    std::vector<double> lat;
+    long long ok = 0, busy = 0, errors = 0, skipped = 0;
+    const uint64_t t0 = t.records.front().ts_us;
+
+    for (size_t idx : mine) {
+        const TraceRecord& r = t.records[idx];
+        if (speed > 0) {
+            long long since = std::max(0LL, (long long)r.ts_us - (long long)t0);
+            auto due = start + std::chrono::microseconds((long long)(since / speed));
+            std::this_thread::sleep_until(due);
+        }
+        auto it = conns.find(r.trace);
+        if (r.op == TraceOp::Tenant) {
+            // the recorded connection identified itself; dial the same way
+            const std::string& id = t.name(r.file);
+            if (it != conns.end() && tenants[r.trace] != id) {
+                closesocket(it->second);
+                conns.erase(it);
+            }
+            tenants[r.trace] = id;
+            continue;
+        }
+        const std::string& tenant = tenants[r.trace];
+        if (it == conns.end()) {
+            SOCKET fresh = dial(tgt);
+            if (fresh == INVALID_SOCKET) { errors++; continue; }
+            send_str(fresh, "TRACE replay:" + t.name(r.trace) + "\n");
+            if (!tenant.empty()) send_str(fresh, "TENANT " + tenant + "\n");
+            it = conns.emplace(r.trace, fresh).first;
+        }
+        SOCKET s = it->second;
+
+        auto a = Clock::now();
+        std::string resp = issue(s, t, r, tenant.empty() ? "" : "tenants/" + tenant + "/", buf);
+        double us = std::chrono::duration<double, std::micro>(Clock::now() - a).count();
+        if (resp == "SKIP") { skipped++; }
+        else if (resp.rfind("OK", 0) == 0) { ok++; lat.push_back(us); }
+        else if (resp == "BUSY") { busy++; lat.push_back(us); }
+        else { errors++; }
+
+        if (resp.empty() || idx == last_of_trace[r.trace]) {
+            closesocket(s);
+            conns.erase(r.trace);
+        }
+    }
+    for (auto& kv : conns) closesocket(kv.second);
+
+    std::lock_guard<std::mutex> lk(st.mtx);
+    st.lat_us.insert(st.lat_us.end(), lat.begin(), lat.end());
+    st.ok += ok; st.busy += busy; st.errors += errors; st.skipped += skipped;
+}
+
+static int cmd_live(const Trace& t, const LiveTarget& tgt, double speed, int threads) {
+    if (t.records.empty()) { std::cout << "empty trace\n"; return 0; }
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) { std::cerr << "WSAStartup failed\n"; return 1; }
+
+    // all requests of one trace id stay on one worker, in order
+    std::vector<std::vector<size_t>> plan(threads);
+    std::vector<size_t> last_of_trace(t.names.size() + 1, 0);
+    for (size_t i = 0; i < t.records.size(); ++i) {
+        plan[t.records[i].trace % threads].push_back(i);
+        if (t.records[i].trace < last_of_trace.size()) last_of_trace[t.records[i].trace] = i;
+    }
+
+    LiveStats st;
+    auto start = Clock::now();
+    std::vector<std::thread> pool;
+    for (int w = 0; w < threads; ++w)
+        pool.emplace_back(live_worker, std::cref(t), std::cref(plan[w]), std::cref(last_of_trace),
+                          std::cref(tgt), speed, start, std::ref(st));
+    for (auto& th : pool) th.join();
+    double sec = std::chrono::duration<double>(Clock::now() - start).count();
+    double recorded = (t.records.back().ts_us - t.records.front().ts_us) / 1e6;
+
+    std::sort(st.lat_us.begin(), st.lat_us.end());
+    auto pct = [&](double p) {
+        return st.lat_us.empty() ? 0.0 : st.lat_us[std::min(st.lat_us.size() - 1, (size_t)(p * st.lat_us.size()))];
+    };
+    std::cout << "Replayed     : " << t.records.size() << " records (" << recorded << " s recorded) in " << sec << " s\n"
+              << "Results      : ok=" << st.ok << " busy=" << st.busy << " errors=" << st.errors
+              << " skipped=" << st.skipped << "\n"
+              << "Latency (us) : p50=" << (int)pct(0.50) << " p99=" << (int)pct(0.99)
+              << " max=" << (int)pct(1.0) << "\n";
+    WSACleanup();
+    return st.errors ? 1 : 0;
+}
+
+static int usage() {
+    std::cerr << "usage: replay info <trace>\n"
+              << "       replay sim  <trace> [--policy lru|fifo|clock|all] [--sizes 16,64,256] [--global]\n"
+              << "       replay live <trace> [[host:]port] [--speed X] [--threads N]\n";
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) return usage();
+    std::string mode = argv[1];
+
+    Trace t;
+    std::string err;
+    auto t0 = Clock::now();
+    if (!t.load(argv[2], err)) { std::cerr << err << "\n"; return 1; }
+    std::cerr << "loaded " << t.records.size() << " records in "
+              << std::chrono::duration<double>(Clock::now() - t0).count() << " s\n";
+
+    std::string policy = "all";
+    std::vector<size_t> sizes = { 8, 16, 32, 64, 128, 256, 512, 1024, 4096 };
+    bool global = false;
+    double speed = 1.0;
+    int threads = 8;
+    LiveTarget tgt;
+
+    for (int i = 3; i < argc; ++i) {
+        std::string a = argv[i];
+        bool has_val = i + 1 < argc;
+        if (a == "--policy" && has_val) policy = argv[++i];
+        else if (a == "--sizes" && has_val) sizes = parse_sizes(argv[++i]);
+        else if (a == "--global") global = true;
+        else if (a == "--speed" && has_val) speed = std::stod(argv[++i]);
+        else if (a == "--threads" && has_val) threads = std::max(1, std::stoi(argv[++i]));
+        else if (mode == "live" && a[0] != '-') {
+            size_t c = a.rfind(':');
+            if (c != std::string::npos) tgt.host = a.substr(0, c);
+            tgt.port = std::stoi(c == std::string::npos ? a : a.substr(c + 1));
+        } else return usage();
+    }
+
+    if (mode == "info") return cmd_info(t);
+    if (mode == "sim") return cmd_sim(t, policy, sizes, global);
+    if (mode == "live") return cmd_live(t, tgt, speed, threads);
+    return usage();
+}
@@ -0,0 +1,60 @@
+#pragma once
+// Consistent-hash ring with virtual nodes, used by the router to place files on shards.
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+static const int RING_VNODES = 160;
+
+struct Shard {
+    std::string host;
+    int port = 0;
+    std::string id() const { return host + ":" + std::to_string(port); }
+};
+
+// "host:port" or just "port" (host defaults to SERVER_ADDR-style loopback)
+static inline bool parse_shard(const std::string& spec, Shard& out) {
+    size_t c = spec.rfind(':');
+    try {
+        out.host = (c == std::string::npos) ? "127.0.0.1" : spec.substr(0, c);
+        out.port = std::stoi(c == std::string::npos ? spec : spec.substr(c + 1));
+    } catch (...) {
+        return false;
+    }
+    return out.port > 0 && out.port < 65536;
+}
+
+static inline uint64_t ring_hash(const std::string& s) {
+    uint64_t h = 1469598103934665603ull;             // FNV-1a
+    for (unsigned char c : s) { h ^= c; h *= 1099511628211ull; }
+    h ^= h >> 33; h *= 0xFF51AFD7ED558CCDull;        // murmur3 finalizer spreads nearby names
+    h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+class HashRing {
+    std::map<uint64_t, size_t> ring_;   // point -> index into nodes_
+    std::vector<Shard> nodes_;
+    int vnodes_;
+public:
+    explicit HashRing(int vnodes = RING_VNODES) : vnodes_(vnodes) {}
+
+    void add(const Shard& s) {
+        size_t idx = nodes_.size();
+        nodes_.push_back(s);
+        for (int v = 0; v < vnodes_; ++v)
+            ring_.emplace(ring_hash(s.id() + "#" + std::to_string(v)), idx);
+    }
+
+    size_t owner(const std::string& name) const {
+        auto it = ring_.lower_bound(ring_hash(name));
+        if (it == ring_.end()) it = ring_.begin();
+        return it->second;
+    }
+
+    const std::vector<Shard>& nodes() const { return nodes_; }
+    size_t size() const { return nodes_.size(); }
+};
@@ -0,0 +1,89 @@
+// ring_test.cpp
+// Checks the placement properties the router relies on (ring.hpp): the same
+// shards always give the same owners, virtual nodes spread names evenly, and
+// adding a shard to N moves about 1/(N+1) of the names, all of them to the
+// new shard.
+//
+//   ring_test          exit status 0 when every case passes
+
+#include "ring.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static int g_failed = 0;
+
+#define CHECK(cond, what)                                        \
+    do {                                                         \
+        if (!(cond)) {                                           \
+            std::printf("FAIL %s: %s\n", what, #cond);          \
+            ++g_failed;                                          \
+        }                                                        \
+    } while (0)
+
+static const int KEYS = 100000;
+
+static HashRing ring_of(int shards) {
+    HashRing r;
+    for (int i = 0; i < shards; ++i) r.add(Shard{ "127.0.0.1", 9100 + i });
+    return r;
+}
+
+static std::string key(int i) {
+    return "file-" + std::to_string(i) + ".txt";
+}
+
+int main() {
+    // deterministic: two rings built the same way agree on every name
+    {
+        HashRing a = ring_of(5), b = ring_of(5);
+        bool same = true;
+        for (int i = 0; i < KEYS; ++i) same = same && a.owner(key(i)) == b.owner(key(i));
+        CHECK(same, "same shards, same placement");
+        CHECK(a.owner("") < a.size(), "empty name has an owner");
+    }
+
+    // balanced: with RING_VNODES points per shard no shard strays far from the mean
+    for (int n : { 2, 4, 8 }) {
+        HashRing r = ring_of(n);
+        std::vector<int> load(n, 0);
+        for (int i = 0; i < KEYS; ++i) load[r.owner(key(i))]++;
+        double mean = (double)KEYS / n;
+        auto mm = std::minmax_element(load.begin(), load.end());
+        std::printf("%d shards: load %d..%d (mean %.0f)\n", n, *mm.first, *mm.second, mean);
+        CHECK(*mm.first > 0.75 * mean && *mm.second < 1.25 * mean, "load within 25% of the mean");
+    }
+
+    // growth: N -> N+1 moves about 1/(N+1) of the names, only onto the new shard
+    for (int n = 1; n <= 8; ++n) {
+        HashRing before = ring_of(n), after = ring_of(n + 1);
+        int moved = 0, elsewhere = 0;
+        for (int i = 0; i < KEYS; ++i) {
+            size_t was = before.owner(key(i)), now = after.owner(key(i));
+            if (was == now) continue;
+            ++moved;
+            if (now != (size_t)n) ++elsewhere;
+        }
+        double frac = (double)moved / KEYS, ideal = 1.0 / (n + 1);
+        std::printf("%d -> %d shards: moved %.3f (ideal %.3f)\n", n, n + 1, frac, ideal);
+        CHECK(frac > 0.75 * ideal && frac < 1.25 * ideal, "moves about 1/(N+1) of the names");
+        CHECK(elsewhere == 0, "moved names go to the new shard");
+    }
+
+    // shard specs
+    {
+        Shard s;
+        CHECK(parse_shard("9101", s) && s.host == "127.0.0.1" && s.port == 9101, "port only");
+        CHECK(parse_shard("10.0.0.2:9102", s) && s.host == "10.0.0.2" && s.port == 9102, "host:port");
+        CHECK(!parse_shard("host:", s) && !parse_shard("70000", s) && !parse_shard("x", s), "bad specs");
+    }
+
+    if (g_failed) {
+        std::printf("%d check(s) failed\n", g_failed);
+        return 1;
+    }
+    std::printf("ring_test: all checks passed\n");
+    return 0;
+}
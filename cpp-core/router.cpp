@@ -0,0 +1,443 @@
+// router.cpp
+// Shard router for N storage servers placed on a consistent-hash ring.
+//
+//   router <listen_port> <shard> [<shard> ...]        proxy mode
+//   router rebalance [--tenant <id>] <shard> [<shard> ...]
+//                                                      move files and trash entries to their owning shard
+//
+// A shard is "host:port" or just "port". Each shard is a normal `server <dir> <port>`.
+// OPEN/READ/WRITE/SIGS/DELTA/ETAG follow the currently open file's shard, name-based
+// commands go to the name's owner and LIST/LISTTRASH are merged across all shards.
+// A name's owner is decided by the name without the " (n)" that TRASH and RESTORE
+// add on collision, so renamed copies stay on the shard that made them.
+// TRACE / TENANT handshake lines are replayed to every shard the session dials.
+
+#include "common.hpp"
+#include "ring.hpp"
+
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const char* DEFAULT_FN = "store.bin";
+static const int   RELAY_CHUNK = 64 * 1024;
+
+static HashRing g_ring;
+static std::mutex g_log_mtx;
+
+// "a (2).txt" -> "a.txt": the server's collision names (stem + " (n)" + extension)
+static std::string placement_name(const std::string& name) {
+    size_t slash = name.find_last_of("/\\");
+    size_t start = slash == std::string::npos ? 0 : slash + 1;
+    size_t dot = name.rfind('.');
+    size_t stem_end = (dot == std::string::npos || dot <= start) ? name.size() : dot;
+    std::string stem = name.substr(0, stem_end), ext = name.substr(stem_end);
+    while (stem.size() > start + 4 && stem.back() == ')') {
+        size_t open = stem.rfind(" (");
+        if (open == std::string::npos || open < start || open + 3 > stem.size() - 1) break;
+        bool digits = true;
+        for (size_t i = open + 2; i + 1 < stem.size(); ++i) digits = digits && isdigit((unsigned char)stem[i]);
+        if (!digits) break;
+        stem.erase(open);
+    }
+    return stem + ext;
+}
+
+static size_t owner_of(const std::string& name) {
+    return g_ring.owner(placement_name(name));
+}
+
+static void log_line(const std::string& msg) {
+    std::lock_guard<std::mutex> lk(g_log_mtx);
+    std::cout << "[router] " << msg << std::endl;
+}
+
+// --- socket utils ---
+static bool send_all(SOCKET s, const char* buf, int len) {
+    int sent = 0;
+    while (sent < len) {
+        int n = send(s, buf + sent, len - sent, 0);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+static bool send_str(SOCKET s, const std::string& str) {
+    return send_all(s, str.data(), (int)str.size());
+}
+
+static bool recv_n(SOCKET s, char* buf, int len) {
+    int got = 0;
+    while (got < len) {
+        int n = recv(s, buf + got, len - got, 0);
+        if (n <= 0) return false;
+        got += n;
+    }
+    return true;
+}
+
+static bool recv_line(SOCKET s, std::string& out) {
+    out.clear();
+    char c;
+    while (true) {
+        int n = recv(s, &c, 1, 0);
+        if (n <= 0) return false;
+        if (c == '\n') break;
+        if (c != '\r') out.push_back(c);
+        if (out.size() > 4096) return false;
+    }
+    return true;
+}
+
+// true if s has a reply (or EOF) waiting to be read
+static bool readable(SOCKET s) {
+    fd_set rd;
+    FD_ZERO(&rd);
+    FD_SET(s, &rd);
+    timeval tv{ 0, 0 };
+    return select((int)s + 1, &rd, nullptr, nullptr, &tv) > 0;
+}
+
+// Copies `len` bytes from one socket to another without buffering the whole body.
+// `left` (if given) ends up with the bytes not yet read from `from`, and
+// `from_gone` tells a failed read from a failed send. With `until_reply` it stops
+// early once `to` has answered: a shard refusing a body (BUSY, or ERR for a bad
+// size) replies before reading it.
+static bool pump(SOCKET from, SOCKET to, long long len, long long* left = nullptr, bool until_reply = false,
+                 bool* from_gone = nullptr) {
+    std::vector<char> buf((size_t)std::min<long long>(len, RELAY_CHUNK));
+    bool ok = true;
+    while (len > 0 && ok) {
+        if (until_reply && readable(to)) break;
+        int n = (int)std::min<long long>(len, RELAY_CHUNK);
+        if (!recv_n(from, buf.data(), n)) {
+            if (from_gone) *from_gone = true;
+            ok = false;
+            break;
+        }
+        len -= n;
+        ok = to == INVALID_SOCKET || send_all(to, buf.data(), n);
+    }
+    if (left) *left = len;
+    return ok;
+}
+
+static SOCKET dial(const Shard& sh) {
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(sh.port);
+    inet_pton(AF_INET, sh.host.c_str(), &addr.sin_addr);
+    if (connect(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+// ---------------- per-client session ----------------
+class Session {
+    SOCKET cs_;
+    std::string trace_, tenant_;        // handshake lines replayed to every upstream
+    std::vector<SOCKET> up_;
+    size_t cur_;                        // shard of the currently open file
+    std::string cur_name_ = DEFAULT_FN;
+public:
+    explicit Session(SOCKET cs)
+        : cs_(cs), up_(g_ring.size(), INVALID_SOCKET), cur_(owner_of(DEFAULT_FN)) {}
+
+    ~Session() {
+        for (SOCKET s : up_) if (s != INVALID_SOCKET) closesocket(s);
+        closesocket(cs_);
+    }
+
+    SOCKET upstream(size_t i) {
+        if (up_[i] != INVALID_SOCKET) return up_[i];
+        SOCKET s = dial(g_ring.nodes()[i]);
+        if (s == INVALID_SOCKET) {
+            log_line("shard " + g_ring.nodes()[i].id() + " unreachable");
+            return INVALID_SOCKET;
+        }
+        std::string hello = (trace_.empty() ? "" : trace_ + "\n") + (tenant_.empty() ? "" : tenant_ + "\n");
+        if (!hello.empty() && !send_str(s, hello)) { closesocket(s); return INVALID_SOCKET; }
+        // the server opens store.bin per connection; follow our open file if it lives here
+        if (i == cur_ && cur_name_ != DEFAULT_FN) {
+            std::string resp;
+            if (!send_str(s, "OPEN " + cur_name_ + "\n") || !recv_line(s, resp)) { closesocket(s); return INVALID_SOCKET; }
+        }
+        up_[i] = s;
+        return s;
+    }
+
+    void drop(size_t i) {
+        if (up_[i] != INVALID_SOCKET) closesocket(up_[i]);
+        up_[i] = INVALID_SOCKET;
+    }
+
+    // Forward `line` (+ `body_len` request bytes) to shard i and relay the reply.
+    // When `reply_body` is set an "OK <n>" reply carries n payload bytes.
+    bool forward(size_t i, const std::string& line, long long body_len, bool reply_body) {
+        SOCKET up = upstream(i);
+        if (up == INVALID_SOCKET) {
+            if (body_len > 0 && !pump(cs_, INVALID_SOCKET, body_len)) return false;
+            return send_str(cs_, "ERR\n");
+        }
+        std::string resp;
+        long long left = body_len;
+        bool client_gone = false;
+        bool sent = send_str(up, line + "\n") && (body_len <= 0 || pump(cs_, up, body_len, &left, true, &client_gone));
+        if (client_gone) { drop(i); return false; }
+        // a shard that answered early has usually answered even if the send then failed
+        bool answered = recv_line(up, resp);
+        if (!sent || !answered || left > 0) {
+            // the shard will not read the rest; whatever the client still has to send
+            // belongs to this request
+            drop(i);
+            if (left > 0 && !pump(cs_, INVALID_SOCKET, left)) return false;
+            if (!answered) return send_str(cs_, "ERR\n");
+        }
+        if (!send_str(cs_, resp + "\n")) return false;
+        if (reply_body && resp.rfind("OK ", 0) == 0) {
+            long long n = std::stoll(resp.substr(3));
+            if (n > 0 && !pump(up, cs_, n)) { drop(i); return false; }
+        }
+        return true;
+    }
+
+    bool merged_list(const std::string& cmd) {
+        std::set<std::string> names;
+        for (size_t i = 0; i < up_.size(); ++i) {
+            SOCKET up = upstream(i);
+            std::string resp;
+            if (up == INVALID_SOCKET || !send_str(up, cmd + "\n") || !recv_line(up, resp) || resp.rfind("OK ", 0) != 0) {
+                drop(i);
+                return send_str(cs_, "ERR\n");
+            }
+            std::string payload((size_t)std::stoll(resp.substr(3)), '\0');
+            if (!payload.empty() && !recv_n(up, &payload[0], (int)payload.size())) { drop(i); return send_str(cs_, "ERR\n"); }
+            std::istringstream in(payload);
+            for (std::string n; std::getline(in, n);) if (!n.empty()) names.insert(n);
+        }
+        std::string out;
+        for (auto& n : names) out += n + "\n";
+        return send_str(cs_, "OK " + std::to_string(out.size()) + "\n") && send_str(cs_, out);
+    }
+
+    void run() {
+        std::string line;
+        while (recv_line(cs_, line)) {
+            if (line.empty()) continue;
+            size_t p1 = line.find(' ');
+            std::string cmd = (p1 == std::string::npos) ? line : line.substr(0, p1);
+            std::string arg = (p1 == std::string::npos) ? "" : line.substr(p1 + 1);
+            bool ok = true;
+
+            if (cmd == "TRACE" || cmd == "TENANT") {
+                // servers only accept these before the first command: keep them for every
+                // dial, and redial shards already talking to us under the old identity
+                (cmd == "TRACE" ? trace_ : tenant_) = line;
+                for (size_t i = 0; i < up_.size(); ++i) drop(i);
+            } else if (cmd == "OPEN") {
+                cur_ = owner_of(arg);
+                cur_name_ = arg;
+                ok = forward(cur_, line, 0, false);
+            } else if (cmd == "ETAG") {
+                ok = forward(cur_, line, 0, false);
+            } else if (cmd == CMD_READ || cmd == "SIGS") {
+                ok = forward(cur_, line, 0, true);
+            } else if (cmd == CMD_WRITE || cmd == "DELTA") {
+                // WRITE <off> <len> / DELTA <block> <new_size> <len>: without a valid
+                // length the body cannot be skipped, so the session ends
+                std::istringstream in(line);
+                std::vector<std::string> f;
+                for (std::string w; in >> w;) f.push_back(w);
+                long long body = 0;
+                if (f.size() != (cmd == CMD_WRITE ? 3u : 4u) || !parse_num(f.back(), body) || body < 0) {
+                    log_line("malformed " + cmd + ": " + line);
+                    send_str(cs_, "ERR\n");
+                    break;
+                }
+                ok = forward(cur_, line, body, false);
+            } else if (cmd == "STAT" || cmd == "TRASH" || cmd == "RESTORE" || cmd == "PURGETRASH") {
+                ok = forward(owner_of(arg), line, 0, false);
+            } else if (cmd == "DELETE") {
+                ok = forward(owner_of(arg), line, 0, false);
+                if (arg == cur_name_) { cur_name_ = DEFAULT_FN; cur_ = owner_of(DEFAULT_FN); }
+            } else if (cmd == "LIST" || cmd == "LISTTRASH") {
+                ok = merged_list(cmd);
+            } else {
+                ok = send_str(cs_, "ERR\n");
+            }
+            if (!ok) break;
+        }
+    }
+};
+
+static void handle_client(SOCKET cs) {
+    Session(cs).run();
+}
+
+// ---------------- rebalance ----------------
+// Moves every file and trash entry that is not on its owning shard. With N shards
+// already placed, adding one more moves roughly 1/(N+1) of them. The source copy
+// is removed (PURGE / PURGETRASH) only once the destination holds it, so nothing
+// passes through the user's trash. A live name that already exists on the
+// destination is left on both shards and reported.
+
+// "OK <n>" + n bytes of newline-separated names
+static bool fetch_names(SOCKET s, const std::string& cmd, std::vector<std::string>& out) {
+    std::string resp;
+    long long n = 0;
+    if (!send_str(s, cmd + "\n") || !recv_line(s, resp) || resp.rfind("OK ", 0) != 0 || !parse_num(resp.substr(3), n)) return false;
+    std::string payload((size_t)n, '\0');
+    if (n > 0 && !recv_n(s, &payload[0], (int)n)) return false;
+    std::istringstream in(payload);
+    for (std::string name; std::getline(in, name);) if (!name.empty()) out.push_back(name);
+    return true;
+}
+
+static bool copy_file(SOCKET src, SOCKET dst, const std::string& name, long long size) {
+    std::string resp;
+    if (!send_str(src, "OPEN " + name + "\n") || !recv_line(src, resp)) return false;
+    if (!send_str(dst, "OPEN " + name + "\n") || !recv_line(dst, resp)) return false;
+
+    for (long long off = 0; off < size;) {
+        long long len = std::min<long long>(size - off, 1 << 20);
+        long long n = 0;
+        if (!send_str(src, CMD_READ + " " + std::to_string(off) + " " + std::to_string(len) + "\n")) return false;
+        if (!recv_line(src, resp) || resp.rfind("OK ", 0) != 0 || !parse_num(resp.substr(3), n)) return false;
+        if (n <= 0) return false;
+        if (!send_str(dst, CMD_WRITE + " " + std::to_string(off) + " " + std::to_string(n) + "\n")) return false;
+        if (!pump(src, dst, n) || !recv_line(dst, resp) || resp.rfind("OK ", 0) != 0) return false;
+        off += n;
+    }
+    return true;
+}
+
+static bool move_file(SOCKET src, SOCKET dst, const std::string& name) {
+    std::string resp;
+    if (!send_str(dst, "STAT " + name + "\n") || !recv_line(dst, resp)) return false;
+    if (resp.rfind("OK ", 0) == 0) {
+        log_line("conflict: " + name + " exists on both shards, left in place");
+        return false;
+    }
+    long long size = 0;
+    if (!send_str(src, "STAT " + name + "\n") || !recv_line(src, resp) || resp.rfind("OK ", 0) != 0 || !parse_num(resp.substr(3), size)) return false;
+    bool copied = copy_file(src, dst, name, size);
+
+    // leave both connections pointing at the default file before removing either copy
+    send_str(src, std::string("OPEN ") + DEFAULT_FN + "\n"); recv_line(src, resp);
+    send_str(dst, std::string("OPEN ") + DEFAULT_FN + "\n"); recv_line(dst, resp);
+    if (!copied) {
+        // a partial copy would read as a conflict on every later rebalance
+        if (!send_str(dst, "PURGE " + name + "\n") || !recv_line(dst, resp) || resp != "OK")
+            log_line("could not remove the partial copy of " + name + " from the destination");
+        return false;
+    }
+    return send_str(src, "PURGE " + name + "\n") && recv_line(src, resp) && resp == "OK";
+}
+
+static bool move_trash_entry(SOCKET src, SOCKET dst, const std::string& name) {
+    std::string resp;
+    long long size = 0;
+    if (!send_str(src, "GETTRASH " + name + "\n") || !recv_line(src, resp) || resp.rfind("OK ", 0) != 0 || !parse_num(resp.substr(3), size)) return false;
+    if (!send_str(dst, "PUTTRASH " + name + " " + std::to_string(size) + "\n") || !pump(src, dst, size)) return false;
+    if (!recv_line(dst, resp) || resp.rfind("OK ", 0) != 0) return false;
+    if (resp.substr(3) != name) log_line("trash entry " + name + " stored as " + resp.substr(3));
+    return send_str(src, "PURGETRASH " + name + "\n") && recv_line(src, resp) && resp == "OK";
+}
+
+static int rebalance(const std::string& tenant) {
+    std::vector<SOCKET> conns;
+    for (auto& sh : g_ring.nodes()) {
+        SOCKET s = dial(sh);
+        if (s == INVALID_SOCKET) { std::cerr << "cannot reach shard " << sh.id() << "\n"; return 1; }
+        send_str(s, "TRACE router:rebalance\n");
+        if (!tenant.empty()) send_str(s, "TENANT " + tenant + "\n");
+        conns.push_back(s);
+    }
+
+    int total = 0, moved = 0, failed = 0;
+    for (size_t i = 0; i < conns.size(); ++i) {
+        std::vector<std::string> live, trash;
+        if (!fetch_names(conns[i], "LIST", live) || !fetch_names(conns[i], "LISTTRASH", trash)) return 1;
+
+        auto place = [&](const std::string& name, bool trashed) {
+            ++total;
+            size_t own = owner_of(name);
+            if (own == i) return;
+            bool ok = trashed ? move_trash_entry(conns[i], conns[own], name) : move_file(conns[i], conns[own], name);
+            std::string what = (trashed ? "trash entry " : "") + name;
+            if (ok) {
+                ++moved;
+                log_line("moved " + what + " " + g_ring.nodes()[i].id() + " -> " + g_ring.nodes()[own].id());
+            } else {
+                ++failed;
+                log_line("failed to move " + what);
+            }
+        };
+        for (auto& name : live) place(name, false);
+        for (auto& name : trash) place(name, true);
+    }
+    for (SOCKET s : conns) closesocket(s);
+    std::cout << "scanned=" << total << " moved=" << moved << " failed=" << failed << "\n";
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "usage: router <listen_port> <shard>...\n"
+                  << "       router rebalance [--tenant <id>] <shard>...\n";
+        return 1;
+    }
+    bool rebalance_mode = std::string(argv[1]) == "rebalance";
+    std::string tenant;
+    int first_shard = 2;
+    if (rebalance_mode && argc > 4 && std::string(argv[2]) == "--tenant") {
+        tenant = argv[3];
+        first_shard = 4;
+    }
+    for (int i = first_shard; i < argc; ++i) {
+        Shard sh;
+        if (!parse_shard(argv[i], sh)) { std::cerr << "bad shard: " << argv[i] << "\n"; return 1; }
+        g_ring.add(sh);
+    }
+
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) { std::cerr << "WSAStartup failed\n"; return 1; }
+    if (rebalance_mode) return rebalance(tenant);
+
+    int port = std::stoi(argv[1]);
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1; setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, SERVER_ADDR.c_str(), &addr.sin_addr);
+
+    if (bind(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) { std::cerr << "bind() failed\n"; return 1; }
+    if (listen(s, SOMAXCONN) == SOCKET_ERROR) { std::cerr << "listen() failed\n"; return 1; }
+
+    log_line("listening on " + SERVER_ADDR + ":" + std::to_string(port) + " with " + std::to_string(g_ring.size()) + " shards");
+    for (auto& sh : g_ring.nodes()) log_line("  shard " + sh.id());
+
+    while (true) {
+        SOCKET cs = accept(s, nullptr, nullptr);
+        if (cs == INVALID_SOCKET) continue;
+        std::thread(handle_client, cs).detach();
+    }
+    return 0;
+}
@@ -0,0 +1,481 @@
+#pragma once
+// Log-structured store for small files. Objects are appended to numbered
+// segment files; an in-memory index maps every name to the segment and offset
+// of its latest contents, so a read is one positioned read from an already open
+// segment and a write is one append. The lock covers the index; reads run outside
+// it, holding a reference that keeps their segment open through compaction.
+//
+// Record layout (little-endian), 16-byte header then the variable parts:
+//   u32 crc32c(rest of record) u32 data_len u16 name_len u16 name2_len
+//   u8 op u8 ns u8 ns2 u8 0   name  name2  data
+//
+//   Put   ns/name holds data
+//   Del   ns/name is gone
+//   Move  ns/name is gone and ns2/name2 holds data (TRASH / RESTORE)
+//
+// Every record states the full contents it refers to, so replaying the
+// segments in id order rebuilds the index no matter which older segments have
+// been compacted away. A torn record at the tail of the newest segment is cut
+// off on open.
+//
+// Overwritten, deleted and purged objects stay behind as dead bytes. compact_once()
+// copies the live objects of the deadest sealed segment to the head of the log,
+// carries its tombstones forward while an older segment could still hold the
+// name, and removes the segment file.
+
+#include "crc32c.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN   // leaves winsock.h out, so winsock2.h can still follow
+#endif
+#include <windows.h>
+#include <io.h>
+
+// positioned I/O on a CRT descriptor; never touches the file pointer others rely on
+inline long long seg_pread(int fd, void* buf, long long n, long long off) {
+    OVERLAPPED ov{};
+    ov.Offset = (DWORD)off;
+    ov.OffsetHigh = (DWORD)(off >> 32);
+    DWORD got = 0;
+    if (!ReadFile((HANDLE)_get_osfhandle(fd), buf, (DWORD)n, &got, &ov)) return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+    return got;
+}
+inline long long seg_pwrite(int fd, const void* buf, long long n, long long off) {
+    OVERLAPPED ov{};
+    ov.Offset = (DWORD)off;
+    ov.OffsetHigh = (DWORD)(off >> 32);
+    DWORD put = 0;
+    if (!WriteFile((HANDLE)_get_osfhandle(fd), buf, (DWORD)n, &put, &ov)) return -1;
+    return put;
+}
+#else
+// POSIX spellings of the CRT calls below, so the store and its test build off Windows
+#include <unistd.h>
+inline long long seg_pread(int fd, void* buf, long long n, long long off) { return ::pread(fd, buf, (size_t)n, (off_t)off); }
+inline long long seg_pwrite(int fd, const void* buf, long long n, long long off) { return ::pwrite(fd, buf, (size_t)n, (off_t)off); }
+inline int  _open(const char* p, int flags, int mode = 0) { return ::open(p, flags, mode); }
+inline int  _read(int fd, void* buf, unsigned n) { return (int)::read(fd, buf, n); }
+inline long _lseek(int fd, long off, int whence) { return (long)::lseek(fd, off, whence); }
+inline int  _close(int fd) { return ::close(fd); }
+inline int  _chsize_s(int fd, long long size) { return ::ftruncate(fd, size); }
+#define _O_RDONLY O_RDONLY
+#define _O_RDWR   O_RDWR
+#define _O_CREAT  O_CREAT
+#define _O_TRUNC  O_TRUNC
+#define _O_BINARY 0
+#define _S_IREAD  S_IRUSR
+#define _S_IWRITE S_IWUSR
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class SegmentStore {
+public:
+    enum Ns : uint8_t { Live = 0, Trash = 1 };
+    enum class WriteResult { Done, Missing, TooBig, Failed };
+
+    struct Stats {
+        size_t segments = 0, objects = 0;
+        long long live_bytes = 0, total_bytes = 0;
+    };
+
+private:
+    enum Op : uint8_t { Put = 1, Del = 2, Move = 3 };
+
+    struct RecHdr {
+        uint32_t crc, data_len;
+        uint16_t name_len, name2_len;
+        uint8_t op, ns, ns2, pad;
+    };
+    static_assert(sizeof(RecHdr) == 16, "segment record header is 16 bytes on disk");
+
+    struct Loc { uint32_t seg; uint32_t rec_len; long long data_off; uint32_t len; };
+    // an open segment file; readers hold a reference while they read outside the lock
+    struct SegFile {
+        int fd;
+        explicit SegFile(int f) : fd(f) {}
+        ~SegFile() { _close(fd); }
+    };
+    struct Segment { std::shared_ptr<SegFile> file; long long size = 0; long long live = 0; };
+
+    std::string dir_;
+    long long max_object_ = 0;      // 0 while the store is off
+    long long seg_limit_ = 0;
+    std::map<uint32_t, Segment> segs_;
+    uint32_t active_ = 0;
+    std::unordered_map<std::string, Loc> idx_[2];
+    long long torn_ = 0;
+    std::mutex mtx_;
+
+    std::string seg_path(uint32_t id) const {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%08u.seg", id);
+        return dir_ + "/" + buf;
+    }
+
+    static bool read_file(int fd, long long size, std::vector<char>& out) {
+        out.resize((size_t)size);
+        _lseek(fd, 0, SEEK_SET);
+        for (long long done = 0; done < size;) {
+            int n = _read(fd, out.data() + done, (unsigned)std::min<long long>(size - done, 1 << 22));
+            if (n <= 0) return false;
+            done += n;
+        }
+        return true;
+    }
+
+    void set_loc(uint8_t ns, const std::string& name, const Loc& l) {
+        auto& slot = idx_[ns][name];
+        if (slot.rec_len) segs_[slot.seg].live -= slot.rec_len;
+        slot = l;
+        segs_[l.seg].live += l.rec_len;
+    }
+
+    void drop_loc(uint8_t ns, const std::string& name) {
+        auto it = idx_[ns].find(name);
+        if (it == idx_[ns].end()) return;
+        segs_[it->second.seg].live -= it->second.rec_len;
+        idx_[ns].erase(it);
+    }
+
+    // index effect of the record at `pos` of segment `seg`
+    void apply(uint32_t seg, long long pos, const RecHdr& h, const std::string& name, const std::string& name2) {
+        uint32_t rec_len = (uint32_t)sizeof(RecHdr) + h.name_len + h.name2_len + h.data_len;
+        Loc l{ seg, rec_len, pos + (long long)sizeof(RecHdr) + h.name_len + h.name2_len, h.data_len };
+        if (h.op == Put) {
+            set_loc(h.ns, name, l);
+        } else if (h.op == Del) {
+            drop_loc(h.ns, name);
+        } else if (h.op == Move) {
+            drop_loc(h.ns, name);
+            set_loc(h.ns2, name2, l);
+        }
+    }
+
+    // Header and length of the intact record at `pos`; false past the valid prefix.
+    static bool record_at(const std::vector<char>& buf, long long pos, RecHdr& h, long long& rec_len) {
+        if (pos + (long long)sizeof(RecHdr) > (long long)buf.size()) return false;
+        std::memcpy(&h, &buf[(size_t)pos], sizeof(h));
+        rec_len = (long long)sizeof(RecHdr) + h.name_len + h.name2_len + h.data_len;
+        if (h.op < Put || h.op > Move || h.ns > Trash || h.ns2 > Trash || pos + rec_len > (long long)buf.size()) return false;
+        return crc32c(&buf[(size_t)pos + 4], (size_t)rec_len - 4) == h.crc;
+    }
+
+    // Replays one segment. Returns the length of its valid prefix.
+    long long replay(uint32_t id, const std::vector<char>& buf) {
+        long long pos = 0, rec_len = 0;
+        RecHdr h;
+        for (; record_at(buf, pos, h, rec_len); pos += rec_len) {
+            const char* p = &buf[(size_t)pos + sizeof(RecHdr)];
+            apply(id, pos, h, std::string(p, h.name_len), std::string(p + h.name_len, h.name2_len));
+        }
+        return pos;
+    }
+
+    bool roll() {
+        uint32_t id = active_ + 1;
+        int fd = _open(seg_path(id).c_str(), _O_CREAT | _O_TRUNC | _O_RDWR | _O_BINARY, _S_IREAD | _S_IWRITE);
+        if (fd < 0) return false;
+        segs_[id] = Segment{ std::make_shared<SegFile>(fd), 0, 0 };
+        active_ = id;
+        return true;
+    }
+
+    // caller holds mtx_
+    bool append(Op op, uint8_t ns, const std::string& name, uint8_t ns2, const std::string& name2,
+                const char* data, size_t n) {
+        if (name.size() > 0xFFFF || name2.size() > 0xFFFF || (long long)n > 0xFFFFFFFFLL) return false;
+        if (segs_[active_].size >= seg_limit_ && !roll()) return false;
+        Segment& s = segs_[active_];
+
+        RecHdr h{ 0, (uint32_t)n, (uint16_t)name.size(), (uint16_t)name2.size(), (uint8_t)op, ns, ns2, 0 };
+        std::vector<char> rec(sizeof(h) + name.size() + name2.size() + n);
+        char* p = rec.data() + sizeof(h);
+        std::memcpy(p, name.data(), name.size());
+        std::memcpy(p + name.size(), name2.data(), name2.size());
+        if (n) std::memcpy(p + name.size() + name2.size(), data, n);
+        std::memcpy(rec.data(), &h, sizeof(h));
+        h.crc = crc32c(rec.data() + 4, rec.size() - 4);
+        std::memcpy(rec.data(), &h.crc, 4);
+
+        if (seg_pwrite(s.file->fd, rec.data(), (long long)rec.size(), s.size) != (long long)rec.size()) {
+            _chsize_s(s.file->fd, s.size);    // drop the partial record
+            return false;
+        }
+        long long pos = s.size;
+        s.size += (long long)rec.size();
+        apply(active_, pos, h, name, name2);
+        return true;
+    }
+
+    static bool read_at(const SegFile& f, long long pos, char* buf, long long n) {
+        for (long long done = 0; done < n;) {
+            long long got = seg_pread(f.fd, buf + done, n - done, pos + done);
+            if (got <= 0) return false;
+            done += got;
+        }
+        return true;
+    }
+
+    // caller holds mtx_; `file` keeps the segment open once the lock is dropped
+    bool locate(uint8_t ns, const std::string& name, Loc& l, std::shared_ptr<SegFile>& file) {
+        auto it = idx_[ns].find(name);
+        if (it == idx_[ns].end()) return false;
+        l = it->second;
+        file = segs_[l.seg].file;
+        return true;
+    }
+
+    // caller holds mtx_
+    bool get_locked(uint8_t ns, const std::string& name, std::vector<char>& out) {
+        Loc l;
+        std::shared_ptr<SegFile> file;
+        if (!locate(ns, name, l, file)) return false;
+        out.resize(l.len);
+        return l.len == 0 || read_at(*file, l.data_off, out.data(), l.len);
+    }
+
+public:
+    // Opens (or creates) the store in `dir` and replays its segments. Objects
+    // larger than `max_object` bytes do not belong here; segments roll over at
+    // `seg_limit` bytes.
+    bool open(const std::string& dir, long long max_object, long long seg_limit) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        fs::create_directories(dir, ec);
+        dir_ = dir;
+        seg_limit_ = seg_limit;
+
+        std::vector<uint32_t> ids;
+        for (auto& e : fs::directory_iterator(dir, ec)) {
+            const std::string f = e.path().filename().string();
+            if (f.size() == 12 && f.compare(8, 4, ".seg") == 0) ids.push_back((uint32_t)std::strtoul(f.c_str(), nullptr, 10));
+        }
+        std::sort(ids.begin(), ids.end());
+
+        std::vector<char> buf;
+        for (uint32_t id : ids) {
+            int fd = _open(seg_path(id).c_str(), _O_RDWR | _O_BINARY);
+            if (fd < 0) return false;
+            long long size = _lseek(fd, 0, SEEK_END);
+            Segment& s = segs_[id];
+            s.file = std::make_shared<SegFile>(fd);
+            if (!read_file(fd, size, buf)) return false;
+            long long valid = replay(id, buf);
+            s.size = size;
+            if (valid < size) {
+                torn_ += size - valid;
+                if (id == ids.back() && _chsize_s(fd, valid) == 0) s.size = valid;   // crash mid-append
+            }
+            active_ = id;
+        }
+        if (segs_.empty() && !roll()) return false;
+        max_object_ = max_object;
+        return true;
+    }
+
+    bool enabled() const { return max_object_ > 0; }
+    long long max_object() const { return max_object_; }
+    long long torn_bytes() const { return torn_; }
+
+    bool contains(Ns ns, const std::string& name) {
+        if (!enabled()) return false;
+        std::lock_guard<std::mutex> lk(mtx_);
+        return idx_[ns].count(name) != 0;
+    }
+
+    long long size(Ns ns, const std::string& name) {
+        if (!enabled()) return -1;
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto it = idx_[ns].find(name);
+        return it == idx_[ns].end() ? -1 : (long long)it->second.len;
+    }
+
+    std::vector<std::string> names(Ns ns) {
+        std::vector<std::string> out;
+        if (!enabled()) return out;
+        std::lock_guard<std::mutex> lk(mtx_);
+        out.reserve(idx_[ns].size());
+        for (auto& kv : idx_[ns]) out.push_back(kv.first);
+        return out;
+    }
+
+    // Reads up to n bytes of a live object from `off`; -1 if it is not packed.
+    int read(const std::string& name, long long off, char* buf, long long n) {
+        if (!enabled()) return -1;
+        Loc l;
+        std::shared_ptr<SegFile> file;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (!locate(Live, name, l, file)) return -1;
+        }
+        n = std::max(0LL, std::min(n, (long long)l.len - off));
+        if (n > 0 && !read_at(*file, l.data_off + off, buf, n)) return -1;
+        return (int)n;
+    }
+
+    bool get(Ns ns, const std::string& name, std::vector<char>& out) {
+        if (!enabled()) return false;
+        Loc l;
+        std::shared_ptr<SegFile> file;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            if (!locate(ns, name, l, file)) return false;
+        }
+        out.resize(l.len);
+        return l.len == 0 || read_at(*file, l.data_off, out.data(), l.len);
+    }
+
+    bool put(const std::string& name, const char* data, size_t n) {
+        if (!enabled()) return false;
+        std::lock_guard<std::mutex> lk(mtx_);
+        return append(Put, Live, name, Live, "", data, n);
+    }
+
+    // empty live object unless the name is already packed
+    bool create(const std::string& name) {
+        if (!enabled()) return false;
+        std::lock_guard<std::mutex> lk(mtx_);
+        return idx_[Live].count(name) || append(Put, Live, name, Live, "", nullptr, 0);
+    }
+
+    // Writes [off, off + n) of a live object. When the result would exceed
+    // max_object nothing is stored and the grown contents come back in `grown`
+    // so the caller can move the object to a regular file.
+    WriteResult write(const std::string& name, long long off, const char* data, long long n, std::vector<char>& grown) {
+        if (!enabled()) return WriteResult::Missing;
+        std::lock_guard<std::mutex> lk(mtx_);
+        std::vector<char> cur;
+        if (!idx_[Live].count(name)) return WriteResult::Missing;
+        if (!get_locked(Live, name, cur)) return WriteResult::Failed;
+        if ((long long)cur.size() < off + n) cur.resize((size_t)(off + n), 0);
+        if (n) std::memcpy(cur.data() + off, data, (size_t)n);
+        if ((long long)cur.size() > max_object_) {
+            grown.swap(cur);
+            return WriteResult::TooBig;
+        }
+        return append(Put, Live, name, Live, "", cur.data(), cur.size()) ? WriteResult::Done : WriteResult::Failed;
+    }
+
+    bool erase(Ns ns, const std::string& name) {
+        if (!enabled()) return false;
+        std::lock_guard<std::mutex> lk(mtx_);
+        return idx_[ns].count(name) && append(Del, ns, name, ns, "", nullptr, 0);
+    }
+
+    // Renames ns/name to ns2/name2, replacing whatever ns2/name2 held.
+    bool move(Ns ns, const std::string& name, Ns ns2, const std::string& name2) {
+        if (!enabled()) return false;
+        std::lock_guard<std::mutex> lk(mtx_);
+        std::vector<char> data;
+        if (!get_locked(ns, name, data)) return false;
+        return append(Move, ns, name, ns2, name2, data.data(), data.size());
+    }
+
+    Stats stats() {
+        Stats st;
+        if (!enabled()) return st;
+        std::lock_guard<std::mutex> lk(mtx_);
+        st.segments = segs_.size();
+        st.objects = idx_[Live].size() + idx_[Trash].size();
+        for (auto& kv : segs_) {
+            st.live_bytes += kv.second.live;
+            st.total_bytes += kv.second.size;
+        }
+        return st;
+    }
+
+    // Compacts the sealed segment with the largest dead fraction, if that
+    // fraction is at least `min_dead`. Returns the bytes reclaimed (0: nothing
+    // to do, -1: I/O error, segment kept).
+    long long compact_once(double min_dead) {
+        if (!enabled()) return 0;
+        uint32_t victim = 0;
+        long long victim_size = 0;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            double best = min_dead;
+            for (auto& kv : segs_) {
+                if (kv.first == active_ || kv.second.size == 0) continue;
+                double dead = 1.0 - (double)kv.second.live / (double)kv.second.size;
+                if (dead >= best) { best = dead; victim = kv.first; victim_size = kv.second.size; }
+            }
+        }
+        if (!victim) return 0;
+
+        // sealed segments never change, so read this one without holding the lock
+        std::vector<char> buf;
+        int fd = _open(seg_path(victim).c_str(), _O_RDONLY | _O_BINARY);
+        if (fd < 0) return -1;
+        bool ok = read_file(fd, victim_size, buf);
+        _close(fd);
+        if (!ok) return -1;
+
+        std::vector<std::pair<uint8_t, std::string>> tombs;
+        RecHdr h;
+        long long rec_len = 0;
+        for (long long pos = 0; record_at(buf, pos, h, rec_len); pos += rec_len)
+            if (h.op == Del || h.op == Move) tombs.emplace_back(h.ns, std::string(&buf[(size_t)pos + sizeof(h)], h.name_len));
+
+        // Names only ever leave a sealed segment, so one snapshot finds every
+        // live object; each is re-checked before it is copied.
+        struct Held { uint8_t ns; std::string name; long long data_off; };
+        std::vector<Held> live;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            for (uint8_t ns = Live; ns <= Trash; ++ns)
+                for (auto& kv : idx_[ns])
+                    if (kv.second.seg == victim) live.push_back({ ns, kv.first, kv.second.data_off });
+        }
+
+        // copy in small batches so readers and writers are only held up briefly
+        const size_t BATCH = 64;
+        long long copied = 0;
+        for (size_t i = 0; i < live.size();) {
+            std::lock_guard<std::mutex> lk(mtx_);
+            for (size_t end = std::min(live.size(), i + BATCH); i < end; ++i) {
+                auto it = idx_[live[i].ns].find(live[i].name);
+                if (it == idx_[live[i].ns].end() || it->second.seg != victim || it->second.data_off != live[i].data_off) continue;
+                uint32_t len = it->second.len;
+                if (!append(Put, live[i].ns, live[i].name, live[i].ns, "", buf.data() + live[i].data_off, len)) return -1;
+                copied += len;
+            }
+        }
+
+        // Tombstones still matter while an older segment may hold the name.
+        std::weak_ptr<SegFile> gone;
+        {
+            std::lock_guard<std::mutex> lk(mtx_);
+            bool older = segs_.begin()->first < victim;
+            for (auto& t : tombs)
+                if (older && !idx_[t.first].count(t.second) && !append(Del, t.first, t.second, t.first, "", nullptr, 0))
+                    return -1;
+            gone = segs_[victim].file;
+            segs_.erase(victim);
+        }
+        // readers that found the old location finish first; the file closes with the last one
+        while (!gone.expired()) std::this_thread::yield();
+        std::error_code ec;
+        std::filesystem::remove(seg_path(victim), ec);
+        return victim_size - copied;
+    }
+};
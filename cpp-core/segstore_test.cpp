@@ -0,0 +1,231 @@
+// segstore_test.cpp
+// Drives segstore.hpp through the life of a packed store: writes, overwrites,
+// TRASH/RESTORE moves and deletes over many small segments, compaction of the
+// dead ones, then a reopen that must rebuild exactly the same index from what
+// is left on disk, including after a torn record at the tail, and reads that
+// run while compaction removes the segments they are reading from.
+//
+//   segstore_test          exit status 0 when every case passes
+
+#include "segstore.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static int g_failed = 0;
+
+#define CHECK(cond, what)                                        \
+    do {                                                         \
+        if (!(cond)) {                                           \
+            std::printf("FAIL %s: %s\n", what, #cond);          \
+            ++g_failed;                                          \
+        }                                                        \
+    } while (0)
+
+static const long long MAX_OBJECT = 4096;
+static const long long SEG_LIMIT  = 8192;   // small, so the log spans many segments
+
+// what the store should hold: namespace -> name -> contents
+using Model = std::map<std::string, std::string>[2];
+
+static void check_index(SegmentStore& st, const Model& want, const char* what) {
+    for (int ns = SegmentStore::Live; ns <= SegmentStore::Trash; ++ns) {
+        auto names = st.names((SegmentStore::Ns)ns);
+        CHECK(names.size() == want[ns].size(), what);
+        for (auto& kv : want[ns]) {
+            std::vector<char> got;
+            bool ok = st.get((SegmentStore::Ns)ns, kv.first, got);
+            CHECK(ok, what);
+            CHECK(std::string(got.begin(), got.end()) == kv.second, what);
+            CHECK(st.size((SegmentStore::Ns)ns, kv.first) == (long long)kv.second.size(), what);
+        }
+    }
+}
+
+static std::string blob(std::mt19937_64& rng, size_t n) {
+    std::string s(n, '\0');
+    for (auto& c : s) c = (char)('a' + rng() % 26);
+    return s;
+}
+
+static size_t segment_files(const fs::path& dir) {
+    size_t n = 0;
+    for (auto& e : fs::directory_iterator(dir))
+        if (e.path().extension() == ".seg") ++n;
+    return n;
+}
+
+int main() {
+    std::mt19937_64 rng(7);
+    const fs::path dir = fs::temp_directory_path() /
+        ("segstore_test_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+
+    Model model;
+    {
+        SegmentStore st;
+        CHECK(st.open(dir.string(), MAX_OBJECT, SEG_LIMIT), "open empty");
+        CHECK(st.enabled(), "open empty");
+
+        // create, then write at offsets (including past the end: the gap is zeros)
+        CHECK(st.create("a.txt"), "create");
+        std::vector<char> grown;
+        CHECK(st.write("a.txt", 0, "hello", 5, grown) == SegmentStore::WriteResult::Done, "write");
+        CHECK(st.write("a.txt", 8, "!", 1, grown) == SegmentStore::WriteResult::Done, "write past end");
+        model[SegmentStore::Live]["a.txt"] = std::string("hello\0\0\0!", 9);
+        CHECK(st.write("missing.txt", 0, "x", 1, grown) == SegmentStore::WriteResult::Missing, "write missing");
+
+        std::string big = blob(rng, (size_t)MAX_OBJECT);
+        CHECK(st.write("a.txt", 9, big.data(), (long long)big.size(), grown) == SegmentStore::WriteResult::TooBig, "outgrow");
+        CHECK(grown.size() == 9 + big.size(), "outgrow hands back the grown contents");
+        check_index(st, model, "too big leaves the object alone");
+
+        // churn: overwrites, trash/restore moves and deletes over many segments
+        for (int round = 0; round < 400; ++round) {
+            std::string name = "f" + std::to_string(rng() % 40) + ".txt";
+            switch (rng() % 5) {
+                case 0:
+                case 1: {
+                    std::string data = blob(rng, 1 + rng() % 900);
+                    CHECK(st.put(name, data.data(), data.size()), "put");
+                    model[SegmentStore::Live][name] = data;
+                    break;
+                }
+                case 2:
+                    if (model[SegmentStore::Live].count(name)) {
+                        CHECK(st.move(SegmentStore::Live, name, SegmentStore::Trash, name), "trash");
+                        model[SegmentStore::Trash][name] = model[SegmentStore::Live][name];
+                        model[SegmentStore::Live].erase(name);
+                    }
+                    break;
+                case 3:
+                    if (model[SegmentStore::Trash].count(name) && !model[SegmentStore::Live].count(name)) {
+                        CHECK(st.move(SegmentStore::Trash, name, SegmentStore::Live, name), "restore");
+                        model[SegmentStore::Live][name] = model[SegmentStore::Trash][name];
+                        model[SegmentStore::Trash].erase(name);
+                    }
+                    break;
+                default: {
+                    int ns = (int)(rng() % 2);
+                    bool had = model[ns].count(name) != 0;
+                    CHECK(st.erase((SegmentStore::Ns)ns, name) == had, "erase");
+                    model[ns].erase(name);
+                    break;
+                }
+            }
+        }
+        check_index(st, model, "after churn");
+
+        auto before = st.stats();
+        CHECK(before.segments > 4, "churn spans several segments");
+        CHECK(before.live_bytes < before.total_bytes, "overwrites leave dead bytes");
+
+        long long reclaimed = 0;
+        for (long long r; (r = st.compact_once(0.3)) > 0;) reclaimed += r;
+        CHECK(reclaimed > 0, "compaction reclaims dead segments");
+        auto after = st.stats();
+        CHECK(after.total_bytes < before.total_bytes, "compaction shrinks the log");
+        CHECK(after.objects == before.objects, "compaction keeps every object");
+        CHECK(segment_files(dir) == after.segments, "compacted segment files are removed");
+        check_index(st, model, "after compaction");
+    }
+
+    // a fresh open replays whatever compaction left and must agree with the model
+    {
+        SegmentStore st;
+        CHECK(st.open(dir.string(), MAX_OBJECT, SEG_LIMIT), "reopen");
+        CHECK(st.torn_bytes() == 0, "clean reopen");
+        check_index(st, model, "after reopen");
+
+        std::string data = "written after reopen";
+        CHECK(st.put("late.txt", data.data(), data.size()), "put after reopen");
+        model[SegmentStore::Live]["late.txt"] = data;
+    }
+
+    // a record cut short by a crash is dropped and the log stays appendable
+    {
+        fs::path newest;
+        for (auto& e : fs::directory_iterator(dir))
+            if (e.path().extension() == ".seg" && (newest.empty() || e.path().filename() > newest.filename())) newest = e.path();
+        auto intact = fs::file_size(newest);
+        {
+            FILE* f = std::fopen(newest.string().c_str(), "ab");
+            CHECK(f != nullptr, "open newest segment");
+            if (f) {
+                const char partial[] = "\x12\x34\x56\x78\xff\x00\x00\x00\x05";
+                std::fwrite(partial, 1, sizeof(partial) - 1, f);
+                std::fclose(f);
+            }
+        }
+        SegmentStore st;
+        CHECK(st.open(dir.string(), MAX_OBJECT, SEG_LIMIT), "reopen torn");
+        CHECK(st.torn_bytes() > 0, "torn tail is noticed");
+        CHECK(fs::file_size(newest) == intact, "torn tail is cut off");
+        check_index(st, model, "after torn tail");
+
+        std::string data = "after the cut";
+        CHECK(st.put("after.txt", data.data(), data.size()), "append after torn tail");
+        model[SegmentStore::Live]["after.txt"] = data;
+    }
+    {
+        SegmentStore st;
+        CHECK(st.open(dir.string(), MAX_OBJECT, SEG_LIMIT), "reopen after repair");
+        CHECK(st.torn_bytes() == 0, "repaired log reopens clean");
+        check_index(st, model, "after repair");
+    }
+
+    // readers work outside the store lock while compaction copies and removes segments
+    {
+        SegmentStore st;
+        CHECK(st.open(dir.string(), MAX_OBJECT, SEG_LIMIT), "reopen for concurrent reads");
+        std::map<std::string, std::string> stable;
+        for (int round = 0; round < 3; ++round)
+            for (int i = 0; i < 60; ++i) {
+                std::string name = "c" + std::to_string(i) + ".txt";
+                stable[name] = blob(rng, 1 + rng() % 900);
+                CHECK(st.put(name, stable[name].data(), stable[name].size()), "put for concurrent reads");
+            }
+
+        std::atomic<bool> stop{ false };
+        std::atomic<long long> reads{ 0 }, bad{ 0 };
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; ++t)
+            readers.emplace_back([&, t] {
+                std::vector<char> got;
+                char part[64];
+                for (size_t i = (size_t)t; !stop; ++i) {
+                    auto it = std::next(stable.begin(), (long)(i % stable.size()));
+                    bool ok = st.get(SegmentStore::Live, it->first, got) && std::string(got.begin(), got.end()) == it->second;
+                    int n = st.read(it->first, 1, part, sizeof(part));
+                    ok = ok && n >= 0 && std::string(part, (size_t)n) == it->second.substr(1, sizeof(part));
+                    if (!ok) ++bad;
+                    ++reads;
+                }
+            });
+        long long reclaimed = 0;
+        for (long long r; (r = st.compact_once(0.3)) > 0;) reclaimed += r;
+        while (reads < 10000) std::this_thread::yield();
+        stop = true;
+        for (auto& th : readers) th.join();
+        CHECK(reclaimed > 0, "compaction ran under readers");
+        CHECK(bad == 0, "reads during compaction see whole objects");
+    }
+
+    fs::remove_all(dir, ec);
+    if (g_failed) {
+        std::printf("%d check(s) failed\n", g_failed);
+        return 1;
+    }
+    std::printf("segstore_test: all checks passed\n");
+    return 0;
+}
@@ -1,6 +1,12 @@
 
 #include "common.hpp"
+#include "crc32c.hpp"
+#include "delta.hpp"
+#include "lru.hpp"
+#include "segstore.hpp"
+#include "trace.hpp"
 
+#define NOMINMAX
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #pragma comment(lib, "ws2_32.lib")
@@ -9,11 +15,18 @@
 #include <io.h>
 #include <sys/stat.h>
 #include <direct.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <list>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <string>
 #include <iostream>
@@ -28,6 +41,28 @@ namespace fs = std::filesystem;
 static std::string DATA_DIR = "data";
 static const char* DEFAULT_FN = "store.bin";
 
+// admission control
+static const int       WORKER_THREADS       = 64;        // connections served concurrently
+static const size_t    ACCEPT_QUEUE_MAX     = 256;       // accepted but waiting for a worker
+static const int       QUEUE_TIMEOUT_MS     = 2000;      // shed connections that waited longer
+static const int       PEER_WORKERS_MAX     = 16;        // workers one peer can hold before it queues
+static const int       IDLE_TIMEOUT_MS      = 30000;     // free the worker of a silent client
+static const long long MAX_INFLIGHT_BYTES   = 256LL << 20;
+static const long long MIN_CLIENT_SHARE     = 16LL << 20; // fair share never drops below this
+static const long long IO_CHUNK_BYTES       = 4LL << 20;  // larger READ/WRITE stream in chunks
+static const long long MAX_DELTA_BYTES      = 64LL << 20;
+
+// tenants share the cache and the disk by weight (NFS_TENANT_WEIGHTS)
+static const long long CACHE_BUDGET_BYTES   = 512LL << 20; // all block caches together (NFS_TENANT_CACHE_MB)
+static const int       DISK_READ_SLOTS      = 8;         // disk reads in flight before tenants queue
+static const size_t    TENANT_ID_MAX        = 64;
+
+// packed small-file store, on with NFS_PACKED=1
+static const long long PACKED_MAX_OBJECT    = 64LL << 10; // larger files get their own file (NFS_PACKED_MAX_KB)
+static const long long PACKED_SEGMENT_BYTES = 64LL << 20;
+static const double    PACKED_COMPACT_DEAD  = 0.5;        // compact sealed segments at least this dead
+static const int       PACKED_COMPACT_INTERVAL_S = 10;
+
 // ----------- timestamped thread-safe logger with color + trace ID -----------
 static std::mutex g_log_mtx;
 
@@ -86,94 +121,457 @@ static void set_data_dir_from_env() {
     LOGI("📁 Data directory set to: " + DATA_DIR);
 }
 
-// ---------------- LRU cache ----------------
-struct Key {
-    long long off = 0, len = 0;
-    bool operator==(const Key& o) const { return off == o.off && len == o.len; }
-};
-struct KeyHash {
-    size_t operator()(const Key& k) const {
-        return std::hash<long long>()(k.off ^ (k.len * 11400714819323198485ull));
+// ---------------- request trace ----------------
+// Enabled with NFS_TRACE_FILE=<path>; replay with `replay sim|live <path>`.
+static TraceWriter g_trace;
+static std::atomic<long long> g_conn_seq{ 0 };   // numbers connections that sent no TRACE
+
+static void open_trace_from_env() {
+    const char* env = std::getenv("NFS_TRACE_FILE");
+    if (!env || !*env) return;
+    if (g_trace.open(env)) LOGI(std::string("🎞️ Recording request trace to ") + env);
+    else LOGW(std::string("Could not open trace file ") + env);
+}
+
+// ---------------- tenants ----------------
+// A `TENANT <id>` handshake line puts the connection in DATA_DIR/tenants/<id>/,
+// with its own files and .trash. Internally every file name carries that
+// prefix, so caches, checksums and the packed store are scoped by tenant
+// without knowing about them. Connections without TENANT use DATA_DIR itself.
+static std::unordered_map<std::string, double> g_tenant_weights;   // fixed after startup
+
+static bool valid_tenant_id(const std::string& id) {
+    if (id.empty() || id.size() > TENANT_ID_MAX || id == "-") return false;   // "-" names the root namespace
+    for (char c : id)
+        if (!isalnum((unsigned char)c) && c != '-' && c != '_') return false;
+    return true;
+}
+
+static std::string tenant_ns(const std::string& id) {
+    return id.empty() ? "" : "tenants/" + id + "/";
+}
+
+// "tenants/<id>/name" -> "<id>"; "" for the root namespace
+static std::string tenant_of(const std::string& fname) {
+    if (fname.rfind("tenants/", 0) != 0) return "";
+    size_t end = fname.find('/', 8);
+    return end == std::string::npos ? "" : fname.substr(8, end - 8);
+}
+
+static double tenant_weight(const std::string& id) {
+    auto it = g_tenant_weights.find(id);
+    return it == g_tenant_weights.end() ? 1.0 : it->second;
+}
+
+// a file name any connection may use: no path separators, no "." / "..", so the
+// root namespace cannot reach into tenants/<id>/ and no one can leave DATA_DIR
+static bool plain_name(const std::string& name) {
+    return !name.empty() && name != "." && name != ".." && name.find_first_of("/\\") == std::string::npos;
+}
+
+// NFS_TENANT_WEIGHTS="media=1,web=4" (unlisted tenants weigh 1; "-" is the root namespace)
+static void load_tenant_weights_from_env() {
+    const char* env = std::getenv("NFS_TENANT_WEIGHTS");
+    if (!env || !*env) return;
+    std::stringstream in(env);
+    for (std::string item; std::getline(in, item, ',');) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) continue;
+        std::string id = item.substr(0, eq);
+        double w = std::atof(item.c_str() + eq + 1);
+        if (w <= 0) continue;
+        g_tenant_weights[id == "-" ? "" : id] = w;
+        LOGI("🏢 Tenant " + id + " weight " + std::to_string(w));
     }
-};
+}
+
+// Disk reads (cache fills and streamed chunks) take one of DISK_READ_SLOTS.
+// Once all are busy, waiting reads are granted in order of virtual finish time,
+// start + bytes / weight, where start is the later of the tenant's previous
+// finish and the current virtual time. A tenant streaming large files gets its
+// weighted share of the disk and small reads from light tenants go first.
+class FairDisk {
+    struct Waiter { double start; bool granted = false; };
 
-class LRU {
-    using Node = std::pair<Key, std::vector<char>>;
-    using It   = std::list<Node>::iterator;
-    std::list<Node> order_;
-    std::unordered_map<Key, It, KeyHash> map_;
-    size_t cap_;
     std::mutex mtx_;
+    std::condition_variable cv_;
+    int free_;
+    double vtime_ = 0;
+    uint64_t seq_ = 0;
+    std::unordered_map<std::string, double> finish_;           // per tenant
+    std::map<std::pair<double, uint64_t>, Waiter*> queue_;     // by finish tag, then arrival
 public:
-    explicit LRU(size_t cap) : cap_(cap) {}
+    explicit FairDisk(int slots) : free_(slots) {}
+
+    void acquire(const std::string& tenant, long long bytes) {
+        std::unique_lock<std::mutex> lk(mtx_);
+        double& fin = finish_[tenant];
+        Waiter w{ std::max(vtime_, fin) };
+        fin = w.start + (double)std::max(bytes, 1LL) / tenant_weight(tenant);
+        if (free_ > 0 && queue_.empty()) {
+            --free_;
+            vtime_ = std::max(vtime_, w.start);
+            return;
+        }
+        queue_.emplace(std::make_pair(fin, seq_++), &w);
+        cv_.wait(lk, [&] { return w.granted; });
+    }
 
-    bool get(const Key& k, std::vector<char>& out) {
+    void release() {
         std::lock_guard<std::mutex> lk(mtx_);
-        auto it = map_.find(k);
-        if (it == map_.end()) {
-            // 🔥 DEBUG LOG
-            LOGW("LRU MISS: off=" + std::to_string(k.off) + " len=" + std::to_string(k.len));
-            return false;
-        }
+        if (queue_.empty()) { ++free_; return; }
+        Waiter* w = queue_.begin()->second;
+        queue_.erase(queue_.begin());
+        vtime_ = std::max(vtime_, w->start);
+        w->granted = true;
+        cv_.notify_all();
+    }
+};
+
+static FairDisk g_disk(DISK_READ_SLOTS);
 
-        order_.splice(order_.begin(), order_, it->second);
-        out = it->second->second;
+class DiskTurn {
+public:
+    DiskTurn(const std::string& tenant, long long bytes) { g_disk.acquire(tenant, bytes); }
+    ~DiskTurn() { g_disk.release(); }
+    DiskTurn(const DiskTurn&) = delete;
+    DiskTurn& operator=(const DiskTurn&) = delete;
+};
 
-        // 🔥 DEBUG LOG
-        LOGI("LRU HIT: off=" + std::to_string(k.off) + " len=" + std::to_string(k.len));
+// ---------------- packed store (segstore.hpp) ----------------
+// Small files live in segment files under DATA_DIR/.segments instead of one
+// file each; see start_packed_store_from_env.
+static SegmentStore g_packed;
 
-        return true;
+// ---------------- per-file caches (lru.hpp) ----------------
+// Caches are shared: a reader keeps the one it is filling alive even if the file
+// is deleted and its cache dropped from the table meanwhile.
+static std::mutex g_caches_mtx;
+static std::unordered_map<std::string, std::shared_ptr<LRU>> g_fileCaches;
+static std::atomic<size_t> g_cache_capacity{ CACHE_CAPACITY };   // entries per file, see autosizer
+static std::atomic<long long> g_cache_reads{ 0 }, g_cache_hits{ 0 }, g_cache_joined{ 0 };
+static std::unordered_set<const LRU*> g_active_caches;   // read since the last autosize pass; g_caches_mtx
+
+// Cache bytes are charged to the file's tenant. Every tenant holding cached data
+// is guaranteed budget * weight / (total weight of such tenants) and may borrow
+// beyond that while the budget has room; once it is exceeded the tenant
+// furthest above its guarantee gives entries back first.
+struct TenantCache {
+    std::atomic<long long> bytes{ 0 };
+    std::vector<std::shared_ptr<LRU>> caches;
+};
+static std::unordered_map<std::string, std::unique_ptr<TenantCache>> g_tenant_caches;   // g_caches_mtx
+static long long g_cache_budget = CACHE_BUDGET_BYTES;
+static std::atomic<long long> g_cache_reclaimed{ 0 };
+
+static TenantCache& tenant_cache_locked(const std::string& tenant) {
+    auto& tc = g_tenant_caches[tenant];
+    if (!tc) tc = std::make_unique<TenantCache>();
+    return *tc;
+}
+
+static std::shared_ptr<LRU> cache_for(const std::string& name) {
+    std::lock_guard<std::mutex> lk(g_caches_mtx);
+    auto it = g_fileCaches.find(name);
+    if (it != g_fileCaches.end()) {
+        g_active_caches.insert(it->second.get());
+        return it->second;
     }
+    TenantCache& tc = tenant_cache_locked(tenant_of(name));
+    auto l = std::make_shared<LRU>(g_cache_capacity, &tc.bytes);
+    tc.caches.push_back(l);
+    g_fileCaches[name] = l;
+    g_active_caches.insert(l.get());
+    return l;
+}
 
-    void put(const Key& k, std::vector<char>&& val) {
-        std::lock_guard<std::mutex> lk(mtx_);
-        auto it = map_.find(k);
-        if (it != map_.end()) {
-            it->second->second = std::move(val);
-            order_.splice(order_.begin(), order_, it->second);
+// caller holds g_caches_mtx
+static long long tenant_share_locked(const std::string& tenant, double active_weight) {
+    return active_weight > 0 ? (long long)((double)g_cache_budget * tenant_weight(tenant) / active_weight) : g_cache_budget;
+}
 
-            // 🔥 DEBUG LOG
-            LOGI("LRU UPDATE (existing): off=" + std::to_string(k.off) + " len=" + std::to_string(k.len));
-            return;
-        }
+static double active_weight_locked() {
+    double w = 0;
+    for (auto& kv : g_tenant_caches)
+        if (kv.second->bytes > 0) w += tenant_weight(kv.first);
+    return w;
+}
 
-        order_.emplace_front(k, std::move(val));
-        map_[k] = order_.begin();
+static void enforce_cache_shares() {
+    std::lock_guard<std::mutex> lk(g_caches_mtx);
+    long long total = 0;
+    for (auto& kv : g_tenant_caches) total += kv.second->bytes;
+    if (total <= g_cache_budget) return;
+
+    double active = active_weight_locked();
+    while (total > g_cache_budget) {
+        TenantCache* victim = nullptr;
+        long long worst = 0;
+        for (auto& kv : g_tenant_caches) {
+            long long over = kv.second->bytes - tenant_share_locked(kv.first, active);
+            if (over > worst) { worst = over; victim = kv.second.get(); }
+        }
+        if (!victim) break;
+        // take it from the tenant's biggest file cache
+        LRU* big = nullptr;
+        size_t big_bytes = 0;
+        for (auto& l : victim->caches) {
+            size_t b = l->bytes();
+            if (b > big_bytes) { big_bytes = b; big = l.get(); }
+        }
+        if (!big) break;
+        long long freed = (long long)big->evict_bytes((size_t)std::min(worst, total - g_cache_budget));
+        if (freed <= 0) break;
+        total -= freed;
+        g_cache_reclaimed += freed;
+    }
+}
 
-        // 🔥 DEBUG LOG
-        LOGI("LRU INSERT: off=" + std::to_string(k.off) + " len=" + std::to_string(k.len));
+// NFS_TENANT_CACHE_MB caps the bytes all block caches hold together, split
+// between tenants by weight. Independent of autosizing, which only picks entries per file.
+static void load_cache_budget_from_env() {
+    const char* env = std::getenv("NFS_TENANT_CACHE_MB");
+    if (!env || !*env) return;
+    long long mb = std::atoll(env);
+    if (mb <= 0) return;
+    g_cache_budget = mb << 20;
+    LOGI("🏢 Tenant cache budget " + std::to_string(mb) + " MB");
+}
 
-        if (map_.size() > cap_) {
-            auto& back = order_.back();
-            Key victim = back.first;
+// ---------------- miss-ratio curve ----------------
+// SHARDS-style estimate of the per-file LRU miss ratio at every capacity: only keys
+// whose hash falls under the sampling threshold are tracked, and their reuse
+// distances (distinct sampled keys since the last touch) are scaled up by the rate.
+// Writes clear a file's cache, so they reset that file's stack too. The histogram
+// is aged every autosize pass so the curve follows the current workload.
+// A file's stack is a run of access slots with a Fenwick tree marking the slot each
+// key was last touched in, so a reuse distance is one prefix count instead of a walk.
+// Sampling cannot tell capacities apart below MRC_SAMPLE_DEN entries, so the curve
+// starts there.
+static const uint64_t MRC_SAMPLE_DEN  = 64;       // track 1 in 64 keys
+static const double   MRC_KEEP        = 0.75;     // weight an interval's samples keep per pass
+static const size_t   MRC_MAX_STACK   = 2048;     // sampled keys remembered per file
+static const size_t   MRC_MAX_DIST    = MRC_MAX_STACK * MRC_SAMPLE_DEN;
+static const int      AUTOSIZE_INTERVAL_S = 10;
+static const long long AUTOSIZE_MIN_SAMPLES = 200;
+
+class MissRatioCurve {
+    struct FileStack {
+        std::vector<int> tree;                       // Fenwick over slots, 1 = a key's last touch
+        std::vector<uint64_t> keys;                  // key touched in each slot
+        std::unordered_map<uint64_t, size_t> pos;    // key -> its current slot
+        size_t next = 0, oldest = 0;                 // slots [oldest, next) may be live
+
+        void mark(size_t slot, int v) {
+            for (size_t i = slot + 1; i <= tree.size(); i += i & (0 - i)) tree[i - 1] += v;
+        }
+        int before(size_t slot) const {              // live keys in slots [0, slot)
+            int n = 0;
+            for (size_t i = slot; i > 0; i -= i & (0 - i)) n += tree[i - 1];
+            return n;
+        }
+        bool live(size_t slot) const {
+            auto it = pos.find(keys[slot]);
+            return it != pos.end() && it->second == slot;
+        }
 
-            // 🔥 DEBUG LOG
-            LOGW("LRU EVICT: off=" + std::to_string(victim.off) + " len=" + std::to_string(victim.len));
+        // slots run out every so often: pack the live keys to the front, in order,
+        // into a tree sized for them (MRC_MAX_STACK keys at most)
+        void renumber() {
+            std::vector<uint64_t> order;
+            for (size_t s = oldest; s < next; ++s) if (live(s)) order.push_back(keys[s]);
+            size_t size = 64;
+            while (size < 2 * (order.size() + 1)) size *= 2;
+            tree.assign(size, 0);
+            keys.assign(size, 0);
+            next = oldest = 0;
+            for (uint64_t k : order) { keys[next] = k; pos[k] = next; mark(next++, 1); }
+        }
 
-            map_.erase(victim);
-            order_.pop_back();
+        // reuse distance of `key` (distinct keys touched since), or -1 when not tracked
+        long long touch(uint64_t key) {
+            long long d = -1;
+            auto it = pos.find(key);
+            if (it != pos.end()) {
+                d = before(next) - before(it->second + 1);
+                mark(it->second, -1);
+                pos.erase(it);
+            }
+            if (next == tree.size()) renumber();
+            keys[next] = key;
+            pos[key] = next;
+            mark(next++, 1);
+            if (pos.size() > MRC_MAX_STACK) {
+                while (!live(oldest)) ++oldest;
+                mark(oldest, -1);
+                pos.erase(keys[oldest++]);
+            }
+            return d;
         }
+    };
+    std::mutex mtx_;
+    std::unordered_map<std::string, FileStack> files_;
+    std::vector<double> hist_ = std::vector<double>(MRC_MAX_STACK, 0);   // by sampled distance, aged
+    double sampled_ = 0, cold_ = 0;
+    double avg_entry_bytes_ = 0;
+
+    static uint64_t mix(uint64_t h) {
+        h ^= h >> 33; h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ull;
+        return h ^ (h >> 33);
     }
+public:
+    void access(const std::string& fname, long long off, long long len) {
+        // the file is part of the key: every file has its own block 0
+        uint64_t h = mix(std::hash<std::string>()(fname) ^ (uint64_t)off ^ ((uint64_t)len * 11400714819323198485ull));
+        if (h % MRC_SAMPLE_DEN != 0) return;
 
-    void clear() {
         std::lock_guard<std::mutex> lk(mtx_);
-        LOGW("LRU CLEAR for this file"); // 🔥 DEBUG
-        order_.clear();
-        map_.clear();
+        avg_entry_bytes_ = avg_entry_bytes_ == 0 ? (double)len : 0.98 * avg_entry_bytes_ + 0.02 * (double)len;
+        ++sampled_;
+        long long d = files_[fname].touch(h);
+        if (d < 0) ++cold_;
+        else ++hist_[(size_t)d];
     }
-};
 
+    void invalidate(const std::string& fname) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        files_.erase(fname);
+    }
 
-static std::mutex g_caches_mtx;
-static std::unordered_map<std::string, LRU*> g_fileCaches;
+    // scales down what has been counted so far; older intervals fade out geometrically
+    void age(double keep) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        for (double& h : hist_) h *= keep;
+        sampled_ *= keep;
+        cold_ *= keep;
+    }
+
+    long long samples() {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return (long long)sampled_;
+    }
+
+    double avg_entry_bytes() {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return avg_entry_bytes_;
+    }
 
-static LRU* cache_for(const std::string& name) {
+    // predicted miss ratio of a per-file LRU holding `cap` entries
+    double miss_ratio(size_t cap) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (sampled_ == 0) return 1.0;
+        double hits = 0;
+        size_t limit = std::min(MRC_MAX_STACK, (cap + MRC_SAMPLE_DEN - 1) / MRC_SAMPLE_DEN);
+        for (size_t d = 0; d < limit; ++d) hits += hist_[d];
+        return 1.0 - hits / sampled_;
+    }
+
+    // capacities the curve is reported at: powers of two the sample can resolve
+    static std::vector<size_t> points() {
+        std::vector<size_t> out;
+        for (size_t c = MRC_SAMPLE_DEN; c <= MRC_MAX_DIST; c *= 2) out.push_back(c);
+        return out;
+    }
+};
+
+static MissRatioCurve g_mrc;
+
+static void resize_caches(size_t cap) {
+    g_cache_capacity = cap;
     std::lock_guard<std::mutex> lk(g_caches_mtx);
-    auto it = g_fileCaches.find(name);
-    if (it != g_fileCaches.end()) return it->second;
-    LRU* l = new LRU(128);
-    g_fileCaches[name] = l;
-    return l;
+    for (auto& kv : g_fileCaches) if (kv.second) kv.second->set_capacity(cap);
+}
+
+// Picks the smallest capacity that reaches the target hit ratio while the worst
+// case (every file read since the last pass full) stays inside the budget. When
+// the target is out of reach it takes the smallest capacity that gives the best
+// affordable hit ratio. Idle caches keep what they hold until the budget
+// enforcement takes it back.
+static void autosize_loop(long long budget_bytes, double target_hit) {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(AUTOSIZE_INTERVAL_S));
+        size_t files;
+        {
+            std::lock_guard<std::mutex> lk(g_caches_mtx);
+            files = std::max<size_t>(1, g_active_caches.size());
+            g_active_caches.clear();
+        }
+        if (g_mrc.samples() < AUTOSIZE_MIN_SAMPLES) { g_mrc.age(MRC_KEEP); continue; }
+
+        double entry = std::max(1.0, g_mrc.avg_entry_bytes());
+        size_t affordable = (size_t)((double)budget_bytes / (entry * (double)files));
+
+        size_t best_cap = 0;
+        double best_hit = -1.0;
+        for (size_t c : MissRatioCurve::points()) {
+            if (c > affordable) break;
+            double hit = 1.0 - g_mrc.miss_ratio(c);
+            if (hit > best_hit + 0.005) { best_hit = hit; best_cap = c; }
+            if (hit >= target_hit) break;
+        }
+        // below the first point the curve says nothing, so that is as small as it goes
+        if (best_cap == 0) best_cap = std::max<size_t>(MRC_SAMPLE_DEN, affordable);
+        if (best_cap != g_cache_capacity) {
+            LOGI("📐 Cache capacity " + std::to_string(g_cache_capacity.load()) + " -> " + std::to_string(best_cap) +
+                 " entries/file (predicted hit " + std::to_string(best_hit) + ", " + std::to_string(files) + " active files)");
+            resize_caches(best_cap);
+        }
+        g_mrc.age(MRC_KEEP);
+    }
+}
+
+// NFS_CACHE_BUDGET_MB turns on automatic sizing, NFS_CACHE_TARGET_HIT (default 0.9) sets the goal.
+// The bytes actually held stay under the tenant cache budget either way.
+static void start_autosize_from_env() {
+    const char* budget = std::getenv("NFS_CACHE_BUDGET_MB");
+    if (!budget || !*budget) return;
+    const char* target = std::getenv("NFS_CACHE_TARGET_HIT");
+    long long bytes = std::atoll(budget) << 20;
+    double hit = (target && *target) ? std::atof(target) : 0.9;
+    LOGI("📐 Cache autosizing on: budget " + std::string(budget) + " MB, target hit " + std::to_string(hit));
+    std::thread(autosize_loop, bytes, hit).detach();
+}
+
+static std::string stats_payload() {
+    size_t files = 0, entries = 0, bytes = 0;
+    {
+        std::lock_guard<std::mutex> lk(g_caches_mtx);
+        files = g_fileCaches.size();
+        for (auto& kv : g_fileCaches) {
+            if (!kv.second) continue;
+            entries += kv.second->size();
+            bytes += kv.second->bytes();
+        }
+    }
+    std::ostringstream out;
+    out << "capacity " << g_cache_capacity << "\n"
+        << "files " << files << "\n"
+        << "entries " << entries << "\n"
+        << "bytes " << bytes << "\n"
+        << "reads " << g_cache_reads << "\n"
+        << "hits " << g_cache_hits << "\n"
+        << "coalesced " << g_cache_joined << "\n"
+        << "mrc_samples " << g_mrc.samples() << "\n";
+    out << "cache_budget " << g_cache_budget << "\n"
+        << "cache_reclaimed " << g_cache_reclaimed << "\n";
+    {
+        std::lock_guard<std::mutex> lk(g_caches_mtx);
+        double active = active_weight_locked();
+        for (auto& kv : g_tenant_caches)
+            out << "tenant " << (kv.first.empty() ? "-" : kv.first) << " bytes " << kv.second->bytes
+                << " share " << tenant_share_locked(kv.first, active) << " weight " << tenant_weight(kv.first) << "\n";
+    }
+    if (g_packed.enabled()) {
+        auto st = g_packed.stats();
+        out << "packed_objects " << st.objects << "\n"
+            << "packed_segments " << st.segments << "\n"
+            << "packed_live_bytes " << st.live_bytes << "\n"
+            << "packed_total_bytes " << st.total_bytes << "\n";
+    }
+    out << std::fixed << std::setprecision(4);
+    for (size_t c : MissRatioCurve::points()) out << "mrc " << c << " " << g_mrc.miss_ratio(c) << "\n";
+    return out.str();
 }
 
 // ---------------- socket helpers ----------------
@@ -236,6 +634,166 @@ static bool recv_line(SOCKET s, std::string& out) {
 
 
 
+// drop a request body we are not going to use so the stream stays in sync
+static bool discard_n(SOCKET s, long long len) {
+    char buf[64 * 1024];
+    while (len > 0) {
+        int n = recv(s, buf, (int)std::min<long long>(len, sizeof(buf)), 0);
+        if (n <= 0) return false;
+        len -= n;
+    }
+    return true;
+}
+
+// Answers a request whose body is still on the wire. Bodies up to one chunk are
+// skipped so the connection stays usable; bigger ones end the connection (false)
+// instead of reading them for nothing while the server is refusing work.
+static bool reject_body(SOCKET s, long long len, const std::string& reply) {
+    bool keep = len <= IO_CHUNK_BYTES && discard_n(s, len);
+    send_all(s, reply.data(), (int)reply.size());
+    return keep;
+}
+
+
+
+// ---------------- admission control ----------------
+// Connections wait in per-client queues that workers drain round-robin; request
+// buffers are charged against a global in-flight budget with a per-client fair share.
+// A client is its peer address until the connection sends TENANT, after which its
+// share is the tenant's. Everything arriving through the gateway therefore counts as
+// one client unless the gateway sends TENANT, and the accept queues, which run before
+// any handshake, only ever separate peers. A peer holding PEER_WORKERS_MAX workers
+// is skipped until one of them frees up, and a sweeper sheds connections that have
+// waited longer than QUEUE_TIMEOUT_MS whether or not a worker is free.
+struct PendingConn {
+    SOCKET cs = INVALID_SOCKET;
+    std::string client;
+    std::chrono::steady_clock::time_point since;
+};
+
+class Admission {
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::unordered_map<std::string, std::deque<PendingConn>> queues_;
+    std::deque<std::string> rr_;                          // clients with queued connections
+    size_t queued_ = 0;
+    long long inflight_ = 0;
+    std::unordered_map<std::string, long long> client_bytes_;
+    std::unordered_map<std::string, int> client_conns_;   // connections held by a worker
+
+    long long share_locked() const {
+        long long active = std::max<long long>(1, (long long)client_conns_.size());
+        return std::max(MAX_INFLIGHT_BYTES / active, MIN_CLIENT_SHARE);
+    }
+
+    // the first client in round-robin order that is below its worker cap
+    std::deque<std::string>::iterator eligible() {
+        return std::find_if(rr_.begin(), rr_.end(), [&](const std::string& client) {
+            auto it = client_conns_.find(client);
+            return it == client_conns_.end() || it->second < PEER_WORKERS_MAX;
+        });
+    }
+public:
+    bool enqueue(PendingConn c) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (queued_ >= ACCEPT_QUEUE_MAX) return false;
+        auto& q = queues_[c.client];
+        if (q.empty()) rr_.push_back(c.client);
+        q.push_back(std::move(c));
+        ++queued_;
+        cv_.notify_one();
+        return true;
+    }
+
+    PendingConn next() {
+        std::unique_lock<std::mutex> lk(mtx_);
+        cv_.wait(lk, [&] { return eligible() != rr_.end(); });
+        auto pick = eligible();
+        std::string client = *pick;
+        rr_.erase(pick);
+        auto& q = queues_[client];
+        PendingConn c = std::move(q.front());
+        q.pop_front();
+        if (q.empty()) queues_.erase(client);
+        else rr_.push_back(client);
+        --queued_;
+        ++client_conns_[c.client];
+        return c;
+    }
+
+    // takes out every queued connection that has waited past QUEUE_TIMEOUT_MS
+    std::vector<PendingConn> expire() {
+        std::vector<PendingConn> out;
+        std::lock_guard<std::mutex> lk(mtx_);
+        auto limit = std::chrono::steady_clock::now() - std::chrono::milliseconds(QUEUE_TIMEOUT_MS);
+        for (auto it = queues_.begin(); it != queues_.end();) {
+            auto& q = it->second;
+            while (!q.empty() && q.front().since < limit) {
+                out.push_back(std::move(q.front()));
+                q.pop_front();
+                --queued_;
+            }
+            if (q.empty()) {
+                rr_.erase(std::find(rr_.begin(), rr_.end(), it->first));
+                it = queues_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return out;
+    }
+
+    void conn_done(const std::string& client) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (--client_conns_[client] <= 0) client_conns_.erase(client);
+        cv_.notify_one();
+    }
+
+    // a connection that identified itself moves from its peer's share to its own
+    void rename(const std::string& from, const std::string& to) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (--client_conns_[from] <= 0) client_conns_.erase(from);
+        ++client_conns_[to];
+        cv_.notify_one();
+    }
+
+    long long share() {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return share_locked();
+    }
+
+    bool acquire(const std::string& client, long long bytes) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        long long& mine = client_bytes_[client];
+        if (inflight_ + bytes > MAX_INFLIGHT_BYTES || mine + bytes > share_locked()) return false;
+        inflight_ += bytes;
+        mine += bytes;
+        return true;
+    }
+
+    void release(const std::string& client, long long bytes) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        inflight_ -= bytes;
+        if ((client_bytes_[client] -= bytes) <= 0) client_bytes_.erase(client);
+    }
+};
+
+static Admission g_admission;
+
+// holds a slice of the in-flight budget for the lifetime of one request
+class InflightGuard {
+    const std::string& client_;
+    long long bytes_;
+    bool ok_;
+public:
+    InflightGuard(const std::string& client, long long bytes)
+        : client_(client), bytes_(bytes), ok_(g_admission.acquire(client, bytes)) {}
+    ~InflightGuard() { if (ok_) g_admission.release(client_, bytes_); }
+    explicit operator bool() const { return ok_; }
+};
+
+
+
 // ---------------- file helpers ----------------
 static void ensure_data_dir() {
     if (!fs::exists(DATA_DIR)) _mkdir(DATA_DIR.c_str());
@@ -252,7 +810,130 @@ static int open_rw_create(const std::string& path) {
     return fd;
 }
 
+// ---------------- packed files ----------------
+// A connection whose current file is packed holds PACKED_FD instead of a
+// descriptor; read_at / write_at dispatch on it.
+static const int PACKED_FD = -2;
+
+static void compact_loop() {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(PACKED_COMPACT_INTERVAL_S));
+        long long freed;
+        while ((freed = g_packed.compact_once(PACKED_COMPACT_DEAD)) > 0) {
+            auto st = g_packed.stats();
+            LOGI("🗜️ Compacted a segment: reclaimed " + std::to_string(freed) + " bytes, " +
+                 std::to_string(st.segments) + " segments / " + std::to_string(st.total_bytes) + " bytes left");
+        }
+        if (freed < 0) LOGE("Segment compaction failed; will retry");
+    }
+}
+
+// NFS_PACKED=1 turns the store on; NFS_PACKED_MAX_KB overrides the size limit
+static void start_packed_store_from_env() {
+    const char* on = std::getenv("NFS_PACKED");
+    if (!on || *on != '1') return;
+    const char* kb = std::getenv("NFS_PACKED_MAX_KB");
+    long long max_object = (kb && *kb) ? std::atoll(kb) << 10 : PACKED_MAX_OBJECT;
+    if (!g_packed.open(DATA_DIR + "/.segments", max_object, PACKED_SEGMENT_BYTES)) {
+        LOGE("Could not open packed store in " + DATA_DIR + "/.segments; small files stay unpacked");
+        return;
+    }
+    if (g_packed.torn_bytes()) LOGW("Packed store: skipped " + std::to_string(g_packed.torn_bytes()) + " bytes of torn records");
+    // a crash between writing a spilled file and dropping its packed copy leaves both
+    for (auto& name : g_packed.names(SegmentStore::Live))
+        if (fs::exists(path_for(name))) g_packed.erase(SegmentStore::Live, name);
+    auto st = g_packed.stats();
+    LOGI("📦 Packed store on: " + std::to_string(st.objects) + " objects in " + std::to_string(st.segments) +
+         " segments, files up to " + std::to_string(max_object) + " bytes");
+    std::thread(compact_loop).detach();
+}
+
+// Existing packed names and new names go to the packed store when it is on;
+// anything already on disk (and the default store.bin) keeps its own file.
+static int open_file(const std::string& name) {
+    if (g_packed.enabled() && fs::path(name).filename() != DEFAULT_FN) {
+        if (g_packed.contains(SegmentStore::Live, name)) return PACKED_FD;
+        if (!fs::exists(path_for(name))) return g_packed.create(name) ? PACKED_FD : -1;
+    }
+    return open_rw_create(path_for(name));
+}
+
+// Moves a packed file that outgrew the store into a regular file.
+static bool spill_packed(const std::string& name, const std::vector<char>& data) {
+    int fd = _open(path_for(name).c_str(), _O_CREAT | _O_TRUNC | _O_RDWR | _O_BINARY, _S_IREAD | _S_IWRITE);
+    if (fd < 0) return false;
+    bool ok = data.empty() || _write(fd, data.data(), (unsigned)data.size()) == (int)data.size();
+    _close(fd);
+    if (!ok || !g_packed.erase(SegmentStore::Live, name)) return false;
+    LOGI("📤 " + name + " outgrew the packed store (" + std::to_string(data.size()) + " bytes), moved to its own file");
+    return true;
+}
+
+// n is one request or one IO_CHUNK_BYTES chunk, never near 2 GB
+static int read_at(int fd, const std::string& fname, long long off, char* buf, long long n) {
+    if (fd == PACKED_FD) {
+        int r = g_packed.read(fname, off, buf, n);
+        if (r >= 0) return r;
+        // spilled to its own file by another connection
+        int rfd = _open(path_for(fname).c_str(), _O_RDONLY | _O_BINARY);
+        if (rfd < 0) return -1;
+        r = read_at(rfd, fname, off, buf, n);
+        _close(rfd);
+        return r;
+    }
+    _lseeki64(fd, off, SEEK_SET);
+    return _read(fd, buf, (unsigned)n);
+}
+
+// caller holds g_write_mtx
+static int write_at(int fd, const std::string& fname, long long off, const char* data, long long n) {
+    if (fd == PACKED_FD) {
+        std::vector<char> grown;
+        switch (g_packed.write(fname, off, data, n, grown)) {
+            case SegmentStore::WriteResult::Done:    return (int)n;
+            case SegmentStore::WriteResult::Failed:  return -1;
+            case SegmentStore::WriteResult::TooBig:  return spill_packed(fname, grown) ? (int)n : -1;
+            case SegmentStore::WriteResult::Missing: break;
+        }
+        if (!fs::exists(path_for(fname))) return -1;   // trashed meanwhile
+        int wfd = open_rw_create(path_for(fname));
+        if (wfd < 0) return -1;
+        int w = write_at(wfd, fname, off, data, n);
+        _close(wfd);
+        return w;
+    }
+    _lseeki64(fd, off, SEEK_SET);
+    return _write(fd, data, (unsigned)n);
+}
+
+// after a write the file may have moved out of the packed store
+static void reopen_if_spilled(int& fd, const std::string& name) {
+    if (fd == PACKED_FD && !g_packed.contains(SegmentStore::Live, name)) fd = open_rw_create(path_for(name));
+}
+
+// where a trashed file lives: "tenants/<id>/x" -> DATA_DIR/tenants/<id>/.trash/x
+static std::string trash_path(const std::string& name) {
+    fs::path p(name);
+    std::string dir = p.has_parent_path() ? DATA_DIR + "/" + p.parent_path().string() : DATA_DIR;
+    return dir + "/.trash/" + p.filename().string();
+}
+
+static bool in_trash(const std::string& name) {
+    return g_packed.contains(SegmentStore::Trash, name) || fs::exists(trash_path(name));
+}
+
+// packed names directly inside namespace `ns`, prefix stripped
+static std::vector<std::string> packed_names_in(SegmentStore::Ns which, const std::string& ns) {
+    std::vector<std::string> out;
+    for (auto& name : g_packed.names(which))
+        if (name.compare(0, ns.size(), ns) == 0 && name.find('/', ns.size()) == std::string::npos)
+            out.push_back(name.substr(ns.size()));
+    return out;
+}
+
 static long long file_size_bytes(const std::string& name) {
+    long long packed = g_packed.size(SegmentStore::Live, name);
+    if (packed >= 0) return packed;
     auto p = path_for(name);
     std::error_code ec;
     auto sz = fs::file_size(p, ec);
@@ -260,9 +941,9 @@ static long long file_size_bytes(const std::string& name) {
     return (long long)sz;
 }
 
-static std::string list_files_payload() {
+static std::string list_files_payload(const std::string& ns) {
     std::string out;
-    for (auto& p : fs::directory_iterator(DATA_DIR)) {
+    for (auto& p : fs::directory_iterator(DATA_DIR + "/" + ns)) {
         if (!p.is_regular_file()) continue;
         const std::string fname = p.path().filename().string();
 
@@ -274,6 +955,7 @@ static std::string list_files_payload() {
         out += fname;
         out += "\n";
     }
+    for (auto& name : packed_names_in(SegmentStore::Live, ns)) out += name + "\n";
     return out;
 }
 
@@ -282,49 +964,339 @@ static std::string list_files_payload() {
 // ---------------- read / write ----------------
 static std::mutex g_write_mtx;
 
+static void invalidate_file_cache(const std::string& fname) {
+    g_mrc.invalidate(fname);
+    std::lock_guard<std::mutex> lk(g_caches_mtx);
+    auto it = g_fileCaches.find(fname);
+    if (it != g_fileCaches.end() && it->second) it->second->clear();
+}
+
+// ---------------- block checksums / ETags ----------------
+// CRC32C of every CRC_BLOCK bytes per file, built on first use and patched by
+// do_write. The ETag is derived from the block checksums and the size, so the
+// same contents keep the same tag across restarts. Building reads the whole file,
+// so it runs outside g_write_mtx and is redone if a write lands meanwhile.
+static const long long CRC_BLOCK = 64 * 1024;
+static const int SUMS_BUILD_TRIES = 3;   // then build under g_write_mtx so busy files still get sums
+static bool g_verify_reads = false;   // NFS_VERIFY=1: check disk reads before they are cached
+
+struct FileSums {
+    std::mutex build_mtx;   // one builder per file
+    std::mutex mtx;
+    uint64_t writes = 0;    // bumped by every change to the file, under mtx
+    bool ready = false;
+    long long size = 0;
+    std::vector<uint32_t> crc;
+};
+
+static std::mutex g_sums_mtx;
+static std::unordered_map<std::string, std::shared_ptr<FileSums>> g_sums;
+
+static std::shared_ptr<FileSums> sums_for(const std::string& fname) {
+    std::lock_guard<std::mutex> lk(g_sums_mtx);
+    auto& sums = g_sums[fname];
+    if (!sums) sums = std::make_shared<FileSums>();
+    return sums;
+}
+
+static void drop_sums(const std::string& fname) {
+    std::lock_guard<std::mutex> lk(g_sums_mtx);
+    auto it = g_sums.find(fname);
+    if (it == g_sums.end()) return;
+    {
+        std::lock_guard<std::mutex> sl(it->second->mtx);
+        it->second->writes++;   // a build in progress must not publish into the dropped entry
+    }
+    g_sums.erase(it);
+}
+
+static bool crc_block_from_disk(int fd, const std::string& fname, long long size, long long b, std::vector<char>& buf, uint32_t& out) {
+    long long off = b * CRC_BLOCK;
+    long long n = std::min(CRC_BLOCK, size - off);
+    buf.resize((size_t)n);
+    if (read_at(fd, fname, off, buf.data(), n) != n) return false;
+    out = crc32c(buf.data(), (size_t)n);
+    return true;
+}
+
+// checksums the file as it is on disk now; no locks held
+static bool build_sums(int fd, const std::string& fname, long long& size, std::vector<uint32_t>& crc) {
+    size = file_size_bytes(fname);
+    if (size < 0) return false;
+    auto start = std::chrono::high_resolution_clock::now();
+    crc.assign((size_t)((size + CRC_BLOCK - 1) / CRC_BLOCK), 0);
+    std::vector<char> buf;
+    for (size_t b = 0; b < crc.size(); ++b)
+        if (!crc_block_from_disk(fd, fname, size, (long long)b, buf, crc[b])) return false;
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    LOGI("🧮 Checksummed " + fname + ": " + std::to_string(crc.size()) + " blocks in " + std::to_string(ms) + " ms");
+    return true;
+}
+
+// The sums are published only if no write touched the file while they were built.
+// A write that finishes its disk update before we publish but patches the sums
+// after is fine: it re-checksums its blocks once they are ready.
+static std::shared_ptr<FileSums> ready_sums(int fd, const std::string& fname) {
+    for (int attempt = 0;; ++attempt) {
+        auto sums = sums_for(fname);
+        std::lock_guard<std::mutex> bl(sums->build_mtx);
+        uint64_t seen;
+        {
+            std::lock_guard<std::mutex> lk(sums->mtx);
+            if (sums->ready) return sums;
+            seen = sums->writes;
+        }
+        std::unique_lock<std::mutex> wl(g_write_mtx, std::defer_lock);
+        if (attempt >= SUMS_BUILD_TRIES) wl.lock();
+        long long size;
+        std::vector<uint32_t> crc;
+        bool ok = build_sums(fd, fname, size, crc);
+        std::lock_guard<std::mutex> lk(sums->mtx);
+        if (sums->writes != seen) continue;   // raced a write: the bytes we summed may be stale
+        if (!ok) return nullptr;
+        sums->crc = std::move(crc);
+        sums->size = size;
+        sums->ready = true;
+        return sums;
+    }
+}
+
+// Re-checksums the blocks touched by a write of [off, off + len); blocks fully
+// covered are summed straight from `data`. Caller holds g_write_mtx.
+static void update_sums_locked(int fd, const std::string& fname, long long off, const char* data, long long len) {
+    std::shared_ptr<FileSums> sums;
+    {
+        std::lock_guard<std::mutex> lk(g_sums_mtx);
+        auto it = g_sums.find(fname);
+        if (it == g_sums.end()) return;
+        sums = it->second;
+    }
+    std::lock_guard<std::mutex> lk(sums->mtx);
+    sums->writes++;
+    if (!sums->ready) return;
+    long long size = file_size_bytes(fname);
+    if (size < 0) { sums->ready = false; return; }
+
+    long long first = off / CRC_BLOCK;
+    long long last = len > 0 ? (off + len - 1) / CRC_BLOCK : first - 1;
+    if (size != sums->size) {   // growth (possibly past a hole) changes the old tail block onwards
+        first = std::min(first, sums->size / CRC_BLOCK);
+        last = (size + CRC_BLOCK - 1) / CRC_BLOCK - 1;
+    }
+    sums->crc.resize((size_t)((size + CRC_BLOCK - 1) / CRC_BLOCK), 0);
+    std::vector<char> buf;
+    for (long long b = first; b <= last && b < (long long)sums->crc.size(); ++b) {
+        long long bo = b * CRC_BLOCK;
+        long long n = std::min(CRC_BLOCK, size - bo);
+        if (bo >= off && bo + n <= off + len) {
+            sums->crc[(size_t)b] = crc32c(data + (bo - off), (size_t)n);
+        } else if (!crc_block_from_disk(fd, fname, size, b, buf, sums->crc[(size_t)b])) {
+            sums->ready = false;
+            return;
+        }
+    }
+    sums->size = size;
+}
+
+static bool file_etag(int fd, const std::string& fname, std::string& out) {
+    auto sums = ready_sums(fd, fname);
+    if (!sums) return false;
+    std::lock_guard<std::mutex> lk(sums->mtx);
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%08x-%llx", crc32c(sums->crc.data(), sums->crc.size() * sizeof(uint32_t)),
+             (unsigned long long)sums->size);
+    out = buf;
+    return true;
+}
+
+// Checks every checksum block that `buf` (read from `off`) fully covers. A
+// mismatch is re-checked against disk under the write lock, since a write may
+// have landed between our read and the check.
+static bool verify_read(int fd, const std::string& fname, long long off, const std::vector<char>& buf, const std::string& trace) {
+    auto sums = ready_sums(fd, fname);
+    if (!sums) return false;
+    long long end = off + (long long)buf.size();
+    for (long long b = (off + CRC_BLOCK - 1) / CRC_BLOCK;; ++b) {
+        long long bo = b * CRC_BLOCK;
+        uint32_t want, got;
+        long long n;
+        {
+            std::lock_guard<std::mutex> lk(sums->mtx);
+            if (b >= (long long)sums->crc.size()) break;
+            n = std::min(CRC_BLOCK, sums->size - bo);
+            if (bo + n > end) break;
+            want = sums->crc[(size_t)b];
+        }
+        got = crc32c(buf.data() + (bo - off), (size_t)n);
+        if (got == want) continue;
+
+        std::lock_guard<std::mutex> wl(g_write_mtx);
+        std::lock_guard<std::mutex> lk(sums->mtx);
+        std::vector<char> disk;
+        uint32_t now = 0;
+        if (b < (long long)sums->crc.size() && crc_block_from_disk(fd, fname, sums->size, b, disk, now) && now == sums->crc[(size_t)b])
+            continue;   // raced a write; the bytes we hold were valid when read
+        log_msg(LogLevel::ERR, "❌ Checksum mismatch in " + fname + " block " + std::to_string(b), trace);
+        return false;
+    }
+    return true;
+}
+
 static bool do_read(int fd, const std::string& fname, long long off, long long len, std::vector<char>& out, const std::string& trace="") {
     log_msg(LogLevel::INFO, "do_read(" + fname + ", off=" + std::to_string(off) + ", len=" + std::to_string(len) + ")", trace);
     if (off < 0 || len < 0) return false;
     Key k{off, len};
-    LRU* lru = cache_for(fname);
-    if (lru->get(k, out)) {
-        log_msg(LogLevel::INFO, "Cache HIT " + fname, trace);
-        return true;
-    }
+    std::shared_ptr<LRU> lru = cache_for(fname);   // held until the fill is done
+    g_mrc.access(fname, off, len);
+    ++g_cache_reads;
     auto start = std::chrono::high_resolution_clock::now();
-    out.assign((size_t)len, 0);
-    _lseek(fd, (long)off, SEEK_SET);
-    int n = _read(fd, out.data(), (unsigned)len);
-    if (n < 0) return false;
-    out.resize((size_t)n);
-    lru->put(k, std::vector<char>(out.begin(), out.end()));
+    Fill fill = lru->get_or_load(k, out, [&](std::vector<char>& buf) {
+        buf.assign((size_t)len, 0);
+        DiskTurn turn(tenant_of(fname), len);
+        int n = read_at(fd, fname, off, buf.data(), len);
+        if (n < 0) return false;
+        buf.resize((size_t)n);
+        return !g_verify_reads || verify_read(fd, fname, off, buf, trace);
+    });
     auto end = std::chrono::high_resolution_clock::now();
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-    log_msg(LogLevel::INFO, "Cache MISS — read " + std::to_string(n) + " bytes in " + std::to_string(ms) + " ms", trace);
-    return true;
+    switch (fill) {
+        case Fill::Hit:
+            ++g_cache_hits;
+            log_msg(LogLevel::INFO, "Cache HIT " + fname, trace);
+            return true;
+        case Fill::Joined:
+            ++g_cache_joined;
+            log_msg(LogLevel::INFO, "Cache MISS — joined in-flight read of " + std::to_string(out.size()) + " bytes (" + std::to_string(ms) + " ms)", trace);
+            return true;
+        case Fill::Loaded:
+            log_msg(LogLevel::INFO, "Cache MISS — read " + std::to_string(out.size()) + " bytes in " + std::to_string(ms) + " ms", trace);
+            enforce_cache_shares();
+            return true;
+        default:
+            return false;
+    }
 }
 
 static bool do_write(int fd, const std::string& fname, long long off, const char* data, long long len, const std::string& trace="") {
     log_msg(LogLevel::INFO, "do_write(" + fname + ", off=" + std::to_string(off) + ", len=" + std::to_string(len) + ")", trace);
     if (off < 0 || len < 0) return false;
 
-    { std::lock_guard<std::mutex> lk(g_caches_mtx);
-      auto it = g_fileCaches.find(fname);
-      if (it != g_fileCaches.end() && it->second) it->second->clear(); }
-
     std::lock_guard<std::mutex> lk2(g_write_mtx);
     auto start = std::chrono::high_resolution_clock::now();
-    _lseek(fd, (long)off, SEEK_SET);
-    int n = _write(fd, data, (unsigned)len);
+    int n = write_at(fd, fname, off, data, len);
+    if (n > 0) update_sums_locked(fd, fname, off, data, n);
+
+    // clear after the write so a miss that read the old bytes meanwhile is not cached
+    invalidate_file_cache(fname);
     auto end = std::chrono::high_resolution_clock::now();
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
     log_msg(LogLevel::INFO, "✅ File write complete: " + std::to_string(n) + " bytes (" + std::to_string(ms) + " ms)", trace);
     return n == len;
 }
 
-static std::string list_trash_payload() {
-    std::string trashDir = DATA_DIR + "/.trash";
+// ---------------- delta sync ----------------
+static bool do_sigs(int fd, const std::string& fname, uint32_t block, std::string& out, const std::string& trace="") {
+    log_msg(LogLevel::INFO, "do_sigs(" + fname + ", block=" + std::to_string(block) + ")", trace);
+    if (block < DELTA_MIN_BLOCK || block > DELTA_MAX_BLOCK) return false;
+    long long size = file_size_bytes(fname);
+    if (size < 0) return false;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    out.clear();
+    out.reserve((size_t)((size + block - 1) / block) * DELTA_SIG_BYTES);
+
+    // scan in batches of blocks so huge files never sit in memory at once
+    const size_t batch = (size_t)block * std::max<uint32_t>(1, (4u << 20) / block);
+    std::vector<char> buf(batch);
+    long long done = 0;
+    while (done < size) {
+        int n = read_at(fd, fname, done, buf.data(), std::min<long long>(batch, size - done));
+        if (n <= 0) return false;
+        const unsigned char* p = (const unsigned char*)buf.data();
+        for (int i = 0; i < n; i += (int)block) {
+            size_t len = std::min<size_t>(block, (size_t)(n - i));
+            encode_sig(out, BlockSig{ weak_checksum(p + i, len), strong_hash(p + i, len) });
+        }
+        done += n;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    log_msg(LogLevel::INFO, "Signatures for " + std::to_string(out.size() / DELTA_SIG_BYTES) + " blocks in " + std::to_string(ms) + " ms", trace);
+    return true;
+}
+
+// Rebuilds the file in place (apply_delta_in_place in delta.hpp): blocks that stay
+// at their offset are not touched, moved ones are copied aside first, through
+// DATA_DIR/.delta.tmp when they do not fit in one IO_CHUNK_BYTES chunk. The plan
+// is made under g_write_mtx so the old size it is checked against is current.
+static bool do_delta(int fd, const std::string& fname, uint32_t block, long long new_size, const std::vector<char>& ops, const std::string& trace="") {
+    log_msg(LogLevel::INFO, "do_delta(" + fname + ", block=" + std::to_string(block) + ", new_size=" + std::to_string(new_size) + ", ops=" + std::to_string(ops.size()) + ")", trace);
+    if (block < DELTA_MIN_BLOCK || block > DELTA_MAX_BLOCK || new_size < 0) return false;
+
+    invalidate_file_cache(fname);
+    std::lock_guard<std::mutex> lk2(g_write_mtx);
+    auto start = std::chrono::high_resolution_clock::now();
+    long long old_size = file_size_bytes(fname);
+    if (old_size < 0) return false;
+    DeltaPlan plan;
+    if (!plan_delta(ops.data(), ops.size(), block, old_size, plan)) return false;
+    if (plan.size != new_size) {
+        log_msg(LogLevel::ERR, "Delta covers " + std::to_string(plan.size) + " bytes, expected " + std::to_string(new_size), trace);
+        return false;
+    }
+
+    long long written = 0;
+    for (auto& pc : plan.pieces) written += pc.len;
+
+    int own_fd = -1;   // a packed file that grows out of the store is rebuilt in its own file
+    if (fd == PACKED_FD) {
+        std::vector<char> old;
+        if (!g_packed.get(SegmentStore::Live, fname, old)) return false;
+        if (new_size <= g_packed.max_object()) {
+            // small enough to assemble the new contents and store them once
+            std::vector<char> img(old);
+            img.resize((size_t)new_size, 0);
+            for (auto& pc : plan.pieces)
+                std::memcpy(img.data() + pc.dst, pc.lit ? pc.lit : old.data() + pc.src, (size_t)pc.len);
+            if (!g_packed.put(fname, img.data(), img.size())) return false;
+        } else {
+            if (!spill_packed(fname, old)) return false;
+            fd = own_fd = open_rw_create(path_for(fname));
+            if (fd < 0) return false;
+        }
+    }
+    if (fd != PACKED_FD) {
+        const std::string stage_path = DATA_DIR + "/.delta.tmp";   // one at a time under g_write_mtx
+        int sfd = -1;
+        if (plan.moved > IO_CHUNK_BYTES) {
+            sfd = _open(stage_path.c_str(), _O_CREAT | _O_TRUNC | _O_RDWR | _O_BINARY, _S_IREAD | _S_IWRITE);
+            if (sfd < 0) { if (own_fd >= 0) _close(own_fd); return false; }
+        }
+        bool ok = apply_delta_in_place(plan, IO_CHUNK_BYTES,
+            [&](long long off, char* buf, long long n) { return (long long)read_at(fd, fname, off, buf, n); },
+            [&](long long off, const char* buf, long long n) { return (long long)write_at(fd, fname, off, buf, n); },
+            [&](long long off, char* buf, long long n) { return (long long)read_at(sfd, "", off, buf, n); },
+            [&](long long off, const char* buf, long long n) { return (long long)write_at(sfd, "", off, buf, n); });
+        if (ok && new_size != old_size) ok = _chsize_s(fd, new_size) == 0;
+        if (sfd >= 0) { _close(sfd); std::error_code ec; fs::remove(stage_path, ec); }
+        if (own_fd >= 0) _close(own_fd);
+        if (!ok) return false;
+    }
+    invalidate_file_cache(fname);
+    drop_sums(fname);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+    log_msg(LogLevel::INFO, "✅ Delta applied: wrote " + std::to_string(written) + " of " + std::to_string(new_size) + " bytes (" +
+            std::to_string(plan.moved) + " moved, " + std::to_string(ms) + " ms)", trace);
+    return true;
+}
+
+static std::string list_trash_payload(const std::string& ns) {
+    std::string trashDir = DATA_DIR + "/" + ns + ".trash";
     std::string out;
+    for (auto& name : packed_names_in(SegmentStore::Trash, ns)) out += name + "\n";
 
     if (!fs::exists(trashDir)) return out;
 
@@ -337,71 +1309,214 @@ static std::string list_trash_payload() {
 }
 
 // ---------------- delete ----------------
+// drops everything cached about a file that left the live namespace
+static void forget_file(const std::string& name) {
+    drop_sums(name);
+    g_mrc.invalidate(name);
+    std::lock_guard<std::mutex> lk(g_caches_mtx);
+    auto it = g_fileCaches.find(name);
+    if (it != g_fileCaches.end() && it->second) {
+        it->second->clear();
+        auto& owned = tenant_cache_locked(tenant_of(name)).caches;
+        owned.erase(std::remove(owned.begin(), owned.end(), it->second), owned.end());
+        g_active_caches.erase(it->second.get());
+        g_fileCaches.erase(it);   // a reader still filling it holds the last reference
+    }
+}
+
+// "a.txt" -> "a (1).txt", "a (2).txt", ...: the first name `taken` rejects
+template <class Taken>
+static std::string free_name(const std::string& name, Taken taken) {
+    fs::path p(name);
+    std::string dir = p.has_parent_path() ? p.parent_path().generic_string() + "/" : "";
+    std::string base = p.stem().string(), ext = p.extension().string();
+    std::string out = name;
+    for (int counter = 1; taken(out); ++counter) out = dir + base + " (" + std::to_string(counter) + ")" + ext;
+    return out;
+}
+
 static bool delete_file_and_cache(const std::string& name, const std::string& trace="") {
     auto p = path_for(name);
     log_msg(LogLevel::WARN, "Deleting file " + name + " -> " + p, trace);
 
     // Ensure .trash directory exists
-    std::string trashDir = DATA_DIR + "/.trash";
+    std::string dest = trash_path(name);
+    std::string trashDir = fs::path(dest).parent_path().string();
     if (!fs::exists(trashDir)) {
         std::error_code ec;
         fs::create_directories(trashDir, ec);
     }
 
     // Move file instead of deleting
-    std::string dest = trashDir + "/" + name;
     std::error_code ec;
-    fs::rename(p, dest, ec);
+    if (g_packed.contains(SegmentStore::Live, name)) {
+        if (!g_packed.move(SegmentStore::Live, name, SegmentStore::Trash, name)) ec = std::make_error_code(std::errc::io_error);
+    } else {
+        fs::rename(p, dest, ec);
+    }
 
     if (ec) {
         log_msg(LogLevel::ERR, "Failed to move to trash: " + ec.message(), trace);
         return false;
     }
 
-    // Clear cache
-    {
-        std::lock_guard<std::mutex> lk(g_caches_mtx);
-        auto it = g_fileCaches.find(name);
-        if (it != g_fileCaches.end() && it->second) {
-            it->second->clear();
-            delete it->second;
-            g_fileCaches.erase(it);
-        }
+    forget_file(name);
+    log_msg(LogLevel::INFO, "✅ Moved to trash: " + dest, trace);
+    return true;
+}
+
+// Deletes a live file for good, without going through the trash. Used by tools
+// that move files between shards (router rebalance).
+static bool purge_live_file(const std::string& name, const std::string& trace="") {
+    std::error_code ec;
+    bool gone = g_packed.contains(SegmentStore::Live, name) ? g_packed.erase(SegmentStore::Live, name)
+                                                            : fs::remove(path_for(name), ec);
+    if (!gone) {
+        log_msg(LogLevel::ERR, "Failed to purge " + name + (ec ? ": " + ec.message() : ""), trace);
+        return false;
     }
+    forget_file(name);
+    log_msg(LogLevel::INFO, "🧹 Purged " + name, trace);
+    return true;
+}
 
-    log_msg(LogLevel::INFO, "✅ Moved to trash: " + dest, trace);
+// ---------------- trash transfer ----------------
+// GETTRASH / PUTTRASH copy a trash entry between shards as-is.
+
+// "OK <n>\n" + the entry's bytes, or ERR. False when the connection broke.
+static bool send_trash_entry(SOCKET cs, const std::string& name) {
+    std::vector<char> buf;
+    if (g_packed.get(SegmentStore::Trash, name, buf)) {
+        std::string hdr = "OK " + std::to_string(buf.size()) + "\n";
+        return send_all(cs, hdr.c_str(), (int)hdr.size()) && (buf.empty() || send_all(cs, buf.data(), (int)buf.size()));
+    }
+    std::string path = trash_path(name);
+    std::error_code ec;
+    long long size = (long long)fs::file_size(path, ec);
+    int tfd = ec ? -1 : _open(path.c_str(), _O_RDONLY | _O_BINARY);
+    if (tfd < 0) return send_all(cs, "ERR\n", 4);
+
+    std::string hdr = "OK " + std::to_string(size) + "\n";
+    bool ok = send_all(cs, hdr.c_str(), (int)hdr.size());
+    buf.resize((size_t)std::min(size, IO_CHUNK_BYTES));
+    for (long long done = 0; ok && done < size;) {
+        int n = (int)std::min(size - done, IO_CHUNK_BYTES);
+        ok = read_at(tfd, "", done, buf.data(), n) == n && send_all(cs, buf.data(), n);   // header already sent
+        done += n;
+    }
+    _close(tfd);
+    return ok;
+}
+
+// Stores `len` bytes from the socket as a trash entry called `name`, renamed on
+// collision like TRASH does; `stored` gets the final name ("" on a disk error).
+// False when the connection broke.
+static bool recv_trash_entry(SOCKET cs, const std::string& name, long long len, std::string& stored) {
+    stored = free_name(name, in_trash);
+    std::string path = trash_path(stored);
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    int tfd = _open(path.c_str(), _O_CREAT | _O_TRUNC | _O_RDWR | _O_BINARY, _S_IREAD | _S_IWRITE);
+
+    std::vector<char> buf((size_t)std::min(len, IO_CHUNK_BYTES));
+    bool alive = true, wrote = tfd >= 0;
+    for (long long done = 0; done < len && alive;) {
+        int n = (int)std::min(len - done, IO_CHUNK_BYTES);
+        alive = recv_n(cs, buf.data(), n);
+        if (alive && wrote) wrote = write_at(tfd, "", done, buf.data(), n) == n;
+        done += n;
+    }
+    if (tfd >= 0) _close(tfd);
+    if (!alive || !wrote) {
+        fs::remove(path, ec);
+        stored.clear();
+    }
+    return alive;
+}
+
+
+// Large reads bypass the cache and go out in IO_CHUNK_BYTES pieces so one
+// request never holds more than a chunk in memory.
+static bool stream_read(SOCKET cs, int fd, const std::string& fname, long long off, long long len, const std::string& hdr_extra, const std::string& trace="") {
+    long long size = file_size_bytes(fname);
+    long long n = std::max(0LL, std::min(len, size - off));
+    log_msg(LogLevel::INFO, "stream_read(" + fname + ", off=" + std::to_string(off) + ", len=" + std::to_string(n) + ")", trace);
+    std::string hdr = "OK " + std::to_string(n) + hdr_extra + "\n";
+    if (!send_all(cs, hdr.c_str(), (int)hdr.size())) return false;
+
+    std::vector<char> buf((size_t)std::min(n, IO_CHUNK_BYTES));
+    for (long long done = 0; done < n;) {
+        int chunk = (int)std::min(n - done, IO_CHUNK_BYTES);
+        {
+            DiskTurn turn(tenant_of(fname), chunk);
+            if (read_at(fd, fname, off + done, buf.data(), chunk) != chunk) return false;   // header already sent
+        }
+        if (!send_all(cs, buf.data(), chunk)) return false;
+        done += chunk;
+    }
     return true;
 }
 
 
 // ---------------- per-client handler ----------------
-static void handle_client(SOCKET cs) {
+// "READ 0 4096" -> { "READ", "0", "4096" }
+static std::vector<std::string> split_args(const std::string& line) {
+    std::vector<std::string> out;
+    std::istringstream in(line);
+    for (std::string w; in >> w;) out.push_back(w);
+    return out;
+}
+
+static void handle_client(SOCKET cs, std::string& client) {
     ensure_data_dir();
     LOGI("🔌 New client connected");
 
     std::string trace_id;
-    std::string pending;   // ← hold the first line if it’s not TRACE
+    std::string tenant;    // empty: the shared root namespace
+    std::string pending;   // ← hold the first line that is not a handshake
 
-    // Read one line to see if it’s TRACE. If not, keep it for the loop.
-    {
+    // TRACE and TENANT lines may precede the first command, in either order.
+    while (true) {
         std::string first;
-        if (recv_line(cs, first)) {
-            if (first.rfind("TRACE ", 0) == 0) {
-                trace_id = first.substr(6);
-                LOGI("🪪 Trace ID: " + trace_id);
-            } else {
-                pending = std::move(first); // ← preserve the real first command
-            }
-        } else {
+        if (!recv_line(cs, first)) {
             // client disconnected immediately
             closesocket(cs);
             return;
         }
+        if (first.rfind("TRACE ", 0) == 0) {
+            trace_id = first.substr(6);
+            LOGI("🪪 Trace ID: " + trace_id);
+        } else if (first.rfind("TENANT ", 0) == 0) {
+            tenant = first.substr(7);
+            if (!valid_tenant_id(tenant)) {
+                LOGW("Rejected tenant id '" + tenant + "'");
+                send_all(cs, "ERR\n", 4);
+                closesocket(cs);
+                return;
+            }
+            LOGI("🏢 Tenant: " + tenant);
+            g_admission.rename(client, "tenant:" + tenant);
+            client = "tenant:" + tenant;
+        } else {
+            pending = std::move(first); // ← preserve the real first command
+            break;
+        }
+    }
+    const std::string ns = tenant_ns(tenant);   // prefix of every file name on this connection
+    if (!ns.empty()) {
+        std::error_code ec;
+        fs::create_directories(DATA_DIR + "/" + ns, ec);
     }
 
     auto TRACE_LOG = [&](LogLevel lvl, const std::string& msg) { log_msg(lvl, msg, trace_id); };
-
-    std::string current_name = DEFAULT_FN;
+    // connections without TRACE still need their own id, or replay would merge them into one
+    const std::string rec_id = trace_id.empty() ? "conn-" + std::to_string(++g_conn_seq) : trace_id;
+    auto TRACE_REC = [&](TraceOp op, const std::string& file, long long off = 0, long long len = 0) {
+        g_trace.record(rec_id, file, op, off, len);
+    };
+    if (!tenant.empty()) TRACE_REC(TraceOp::Tenant, tenant);
+
+    std::string current_name = ns + DEFAULT_FN;
     std::string current_path = path_for(current_name);
     int fd = open_rw_create(current_path);
     if (fd < 0) { send_all(cs, "ERR\n", 4); closesocket(cs); return; }
@@ -423,133 +1538,270 @@ static void handle_client(SOCKET cs) {
         size_t p1 = line.find(' ');
         std::string cmd = (p1 == std::string::npos) ? line : line.substr(0, p1);
 
+        // file names must stay inside the connection's namespace
+        bool names_file = cmd == "OPEN" || cmd == "STAT" || cmd == "DELETE" || cmd == "TRASH" || cmd == "RESTORE" ||
+                          cmd == "PURGETRASH" || cmd == "PURGE" || cmd == "GETTRASH";
+        if (names_file && !plain_name(p1 == std::string::npos ? "" : line.substr(p1 + 1))) {
+            TRACE_LOG(LogLevel::WARN, "Rejected file name in " + (ns.empty() ? std::string("root") : "tenant " + tenant) + ": " + line);
+            send_all(cs, "ERR\n", 4);
+            continue;
+        }
+
         if (cmd == "OPEN") {
-            std::string name = (p1 == std::string::npos) ? "" : line.substr(p1 + 1);
+            std::string name = ns + ((p1 == std::string::npos) ? "" : line.substr(p1 + 1));
             TRACE_LOG(LogLevel::INFO, "OPEN " + name);
+            TRACE_REC(TraceOp::Open, name);
             if (fd >= 0) _close(fd);
             current_name = name;
             current_path = path_for(current_name);
-            fd = open_rw_create(current_path);
+            fd = open_file(current_name);
             cache_for(current_name);
             send_all(cs, "OK\n", 3);
 
         } else if (cmd == "LIST") {
             TRACE_LOG(LogLevel::INFO, "LIST requested");
-            auto payload = list_files_payload();
+            TRACE_REC(TraceOp::List, "");
+            auto payload = list_files_payload(ns);
             std::string hdr = "OK " + std::to_string(payload.size()) + "\n";
             send_all(cs, hdr.c_str(), (int)hdr.size());
             if (!payload.empty()) send_all(cs, payload.c_str(), (int)payload.size());
 
         } else if (cmd == "STAT") {
-            std::string name = (p1 == std::string::npos) ? "" : line.substr(p1 + 1);
+            std::string name = ns + ((p1 == std::string::npos) ? "" : line.substr(p1 + 1));
             long long sz = file_size_bytes(name);
             TRACE_LOG(LogLevel::INFO, "STAT " + name + " = " + std::to_string(sz));
+            TRACE_REC(TraceOp::Stat, name);
             if (sz < 0) { send_all(cs, "ERR\n", 4); continue; }
             std::string hdr = "OK " + std::to_string(sz) + "\n";
             send_all(cs, hdr.c_str(), (int)hdr.size());
 
         } else if (cmd == CMD_READ) {
-            size_t p2 = line.find(' ', p1 + 1);
-            long long off = std::stoll(line.substr(p1 + 1, p2 - (p1 + 1)));
-            long long len = std::stoll(line.substr(p2 + 1));
+            // READ <off> <len> [IFNOT <etag>]
+            auto args = split_args(line);
+            long long off = 0, len = 0;
+            if (args.size() < 3 || !parse_num(args[1], off) || !parse_num(args[2], len)) {
+                TRACE_LOG(LogLevel::ERR, "Malformed READ: " + line);
+                send_all(cs, "ERR\n", 4);
+                continue;
+            }
+            bool conditional = args.size() == 5 && args[3] == "IFNOT";
+            std::string if_not = conditional ? args[4] : "";
             TRACE_LOG(LogLevel::INFO, "READ " + current_name + " off=" + std::to_string(off) + " len=" + std::to_string(len));
+            TRACE_REC(TraceOp::Read, current_name, off, len);
+            if (off < 0 || len < 0) { send_all(cs, "ERR\n", 4); continue; }
+            InflightGuard budget(client, std::min(len, IO_CHUNK_BYTES));
+            if (!budget) {
+                TRACE_LOG(LogLevel::WARN, "BUSY: in-flight budget exhausted for " + client);
+                send_all(cs, "BUSY\n", 5);
+                continue;
+            }
+            // conditional reads answer NOTMODIFIED, or carry the current tag after the length
+            std::string tag_suffix;
+            if (conditional) {
+                std::string tag;
+                if (file_etag(fd, current_name, tag)) {
+                    if (tag == if_not) {
+                        TRACE_LOG(LogLevel::INFO, "NOTMODIFIED " + current_name + " " + tag);
+                        send_all(cs, "NOTMODIFIED\n", 12);
+                        continue;
+                    }
+                    tag_suffix = " " + tag;
+                }
+            }
+            if (len > IO_CHUNK_BYTES) {
+                if (!stream_read(cs, fd, current_name, off, len, tag_suffix, trace_id)) break;
+                continue;
+            }
             std::vector<char> bytes;
             if (!do_read(fd, current_name, off, len, bytes, trace_id)) { send_all(cs, "ERR\n", 4); continue; }
-            std::string hdr = "OK " + std::to_string(bytes.size()) + "\n";
+            std::string hdr = "OK " + std::to_string(bytes.size()) + tag_suffix + "\n";
             send_all(cs, hdr.c_str(), (int)hdr.size());
             if (!bytes.empty()) send_all(cs, bytes.data(), (int)bytes.size());
 
         } else if (cmd == CMD_WRITE) {
-            size_t p2 = line.find(' ', p1 + 1);
-            long long off = std::stoll(line.substr(p1 + 1, p2 - (p1 + 1)));
-            long long len = std::stoll(line.substr(p2 + 1));
+            auto args = split_args(line);
+            long long off = 0, len = 0;
+            if (args.size() != 3 || !parse_num(args[1], off) || !parse_num(args[2], len)) {
+                // without a length the body cannot be skipped: drop the connection
+                TRACE_LOG(LogLevel::ERR, "Malformed WRITE: " + line);
+                send_all(cs, "ERR\n", 4);
+                break;
+            }
             TRACE_LOG(LogLevel::INFO, "WRITE " + current_name + " off=" + std::to_string(off) + " len=" + std::to_string(len));
-            std::vector<char> tmp((size_t)len);
-            if (!recv_n(cs, tmp.data(), (int)len)) { send_all(cs, "ERR\n", 4); continue; }
-            if (!do_write(fd, current_name, off, tmp.data(), len, trace_id)) { send_all(cs, "ERR\n", 4); continue; }
+            TRACE_REC(TraceOp::Write, current_name, off, len);
+            if (off < 0 || len < 0) {
+                if (len > 0 && !discard_n(cs, len)) break;
+                send_all(cs, "ERR\n", 4);
+                continue;
+            }
+            InflightGuard budget(client, std::min(len, IO_CHUNK_BYTES));
+            if (!budget) {
+                TRACE_LOG(LogLevel::WARN, "BUSY: in-flight budget exhausted for " + client);
+                if (!reject_body(cs, len, "BUSY\n")) break;
+                continue;
+            }
+            // receive and write chunk by chunk so the buffer stays bounded
+            std::vector<char> tmp((size_t)std::min(len, IO_CHUNK_BYTES));
+            bool alive = true, wrote = true;
+            for (long long done = 0; done < len && alive;) {
+                int n = (int)std::min(len - done, IO_CHUNK_BYTES);
+                alive = recv_n(cs, tmp.data(), n);
+                if (alive && wrote) wrote = do_write(fd, current_name, off + done, tmp.data(), n, trace_id);
+                reopen_if_spilled(fd, current_name);
+                done += n;
+            }
+            if (!alive) break;
+            if (!wrote) { send_all(cs, "ERR\n", 4); continue; }
             std::string hdr = "OK " + std::to_string(len) + "\n";
             send_all(cs, hdr.c_str(), (int)hdr.size());
 
+        } else if (cmd == "SIGS") {
+            auto args = split_args(line);
+            long long block = DELTA_DEFAULT_BLOCK;
+            if (args.size() > 2 || (args.size() == 2 && !parse_num(args[1], block)) || block < 0 || block > DELTA_MAX_BLOCK) {
+                TRACE_LOG(LogLevel::ERR, "Malformed SIGS: " + line);
+                send_all(cs, "ERR\n", 4);
+                continue;
+            }
+            TRACE_LOG(LogLevel::INFO, "SIGS " + current_name + " block=" + std::to_string(block));
+            TRACE_REC(TraceOp::Sigs, current_name, 0, block);
+            std::string payload;
+            if (!do_sigs(fd, current_name, (uint32_t)block, payload, trace_id)) { send_all(cs, "ERR\n", 4); continue; }
+            std::string hdr = "OK " + std::to_string(payload.size()) + "\n";
+            send_all(cs, hdr.c_str(), (int)hdr.size());
+            if (!payload.empty()) send_all(cs, payload.data(), (int)payload.size());
+
+        } else if (cmd == "DELTA") {
+            auto args = split_args(line);
+            long long block = 0, new_size = 0, len = 0;
+            if (args.size() != 4 || !parse_num(args[1], block) || !parse_num(args[2], new_size) || !parse_num(args[3], len)) {
+                TRACE_LOG(LogLevel::ERR, "Malformed DELTA: " + line);
+                send_all(cs, "ERR\n", 4);
+                break;
+            }
+            TRACE_LOG(LogLevel::INFO, "DELTA " + current_name + " block=" + std::to_string(block) + " new_size=" + std::to_string(new_size) + " len=" + std::to_string(len));
+            TRACE_REC(TraceOp::Delta, current_name, block, new_size);
+            if (len < 0) { send_all(cs, "ERR\n", 4); break; }
+            if (len > MAX_DELTA_BYTES || block < DELTA_MIN_BLOCK || block > DELTA_MAX_BLOCK) {
+                TRACE_LOG(LogLevel::ERR, "DELTA payload too large or bad block size");
+                if (!reject_body(cs, len, "ERR\n")) break;
+                continue;
+            }
+            // the instructions plus the chunk do_delta stages moved blocks in, capped at
+            // the fair share so a large DELTA is refused only while others hold budget
+            InflightGuard budget(client, std::min(len + IO_CHUNK_BYTES, g_admission.share()));
+            if (!budget) {
+                TRACE_LOG(LogLevel::WARN, "BUSY: in-flight budget exhausted for " + client);
+                if (!reject_body(cs, len, "BUSY\n")) break;
+                continue;
+            }
+            std::vector<char> ops((size_t)len);
+            if (!recv_n(cs, ops.data(), (int)len)) break;
+            bool applied = do_delta(fd, current_name, (uint32_t)block, new_size, ops, trace_id);
+            reopen_if_spilled(fd, current_name);
+            if (!applied) { send_all(cs, "ERR\n", 4); continue; }
+            std::string hdr = "OK " + std::to_string(new_size) + "\n";
+            send_all(cs, hdr.c_str(), (int)hdr.size());
+
+        } else if (cmd == "ETAG") {
+            std::string tag;
+            if (!file_etag(fd, current_name, tag)) { send_all(cs, "ERR\n", 4); continue; }
+            TRACE_LOG(LogLevel::INFO, "ETAG " + current_name + " = " + tag);
+            std::string hdr = "OK " + tag + "\n";
+            send_all(cs, hdr.c_str(), (int)hdr.size());
+
+        } else if (cmd == "STATS") {
+            TRACE_LOG(LogLevel::INFO, "STATS requested");
+            auto payload = stats_payload();
+            std::string hdr = "OK " + std::to_string(payload.size()) + "\n";
+            send_all(cs, hdr.c_str(), (int)hdr.size());
+            send_all(cs, payload.c_str(), (int)payload.size());
+
         } else if (cmd == "DELETE") {
-            std::string name = (p1 == std::string::npos) ? "" : line.substr(p1 + 1);
+            std::string name = ns + ((p1 == std::string::npos) ? "" : line.substr(p1 + 1));
             TRACE_LOG(LogLevel::WARN, "DELETE " + name);
+            TRACE_REC(TraceOp::Delete, name);
             bool deleting_current = (name == current_name);
             if (deleting_current && fd >= 0) { _close(fd); fd = -1; }
             bool ok = delete_file_and_cache(name, trace_id);
             if (deleting_current) {
-                current_name = DEFAULT_FN;
+                current_name = ns + DEFAULT_FN;
                 current_path = path_for(current_name);
                 fd = open_rw_create(current_path);
             }
-            send_all(cs, ok ? "OK\n" : "ERR\n", 3);
+            send_all(cs, ok ? "OK\n" : "ERR\n", ok ? 3 : 4);
 
         } else if (cmd == "LISTTRASH") {
             TRACE_LOG(LogLevel::INFO, "LISTTRASH requested");
-            auto payload = list_trash_payload();
+            TRACE_REC(TraceOp::ListTrash, "");
+            auto payload = list_trash_payload(ns);
             std::string hdr = "OK " + std::to_string(payload.size()) + "\n";
             send_all(cs, hdr.c_str(), (int)hdr.size());
             if (!payload.empty()) send_all(cs, payload.c_str(), (int)payload.size());
         } else if (cmd == "TRASH") {
-            std::string name = line.substr(p1 + 1);
+            std::string name = ns + line.substr(p1 + 1);
             TRACE_LOG(LogLevel::WARN, "TRASH " + name);
+            TRACE_REC(TraceOp::Trash, name);
 
             std::string src = path_for(name);
-            std::string trashDir = DATA_DIR + "/.trash";
+            std::string trashDir = DATA_DIR + "/" + ns + ".trash";
             if (!fs::exists(trashDir)) fs::create_directories(trashDir);
 
             // generate a unique name if it already exists
-            std::string dst = trashDir + "/" + name;
             std::error_code ec;
-            int counter = 1;
-            fs::path namePath(name);
-            std::string base = namePath.stem().string();
-            std::string ext = namePath.extension().string();
-            while (fs::exists(dst)) {
-                dst = trashDir + "/" + base + " (" + std::to_string(counter++) + ")" + ext;
-            }
+            std::string dstName = free_name(name, in_trash);
+            std::string dst = trash_path(dstName);
 
-            fs::rename(src, dst, ec);
+            if (g_packed.contains(SegmentStore::Live, name)) {
+                if (!g_packed.move(SegmentStore::Live, name, SegmentStore::Trash, dstName)) ec = std::make_error_code(std::errc::io_error);
+            } else {
+                fs::rename(src, dst, ec);
+            }
             if (ec) {
                 TRACE_LOG(LogLevel::ERR, "Failed to move to trash: " + ec.message());
                 send_all(cs, "ERR\n", 4);
             } else {
+                forget_file(name);
                 TRACE_LOG(LogLevel::INFO, "✅ Moved to trash: " + dst);
                 send_all(cs, "OK\n", 3);
             }
         } else if (cmd == "RESTORE") {
-            std::string name = line.substr(p1 + 1);
+            std::string name = ns + line.substr(p1 + 1);
             TRACE_LOG(LogLevel::INFO, "RESTORE " + name);
+            TRACE_REC(TraceOp::Restore, name);
 
-            std::string trashDir = DATA_DIR + "/.trash";
-            std::string src = trashDir + "/" + name;
+            std::string src = trash_path(name);
 
             // Generate a collision-safe destination name
-            fs::path namePath(name);
-            std::string base = namePath.stem().string();
-            std::string ext  = namePath.extension().string();
-            std::string dst  = DATA_DIR + "/" + name;
-
-            int counter = 1;
-            while (fs::exists(dst)) {
-                dst = DATA_DIR + "/" + base + " (" + std::to_string(counter++) + ")" + ext;
-            }
+            std::string dstName = free_name(name, [](const std::string& n) { return file_size_bytes(n) >= 0; });
+            std::string dst = DATA_DIR + "/" + dstName;
 
             std::error_code ec;
-            fs::rename(src, dst, ec);
+            if (g_packed.contains(SegmentStore::Trash, name)) {
+                if (!g_packed.move(SegmentStore::Trash, name, SegmentStore::Live, dstName)) ec = std::make_error_code(std::errc::io_error);
+            } else {
+                fs::rename(src, dst, ec);
+            }
             if (ec) {
                 TRACE_LOG(LogLevel::ERR, "Failed to restore: " + ec.message());
                 send_all(cs, "ERR\n", 4);
             } else {
+                forget_file(dstName);
                 TRACE_LOG(LogLevel::INFO, "♻️ Restored to: " + dst);
                 send_all(cs, "OK\n", 3);
             }
         } else if (cmd == "PURGETRASH") {
-            std::string name = line.substr(p1 + 1);
+            std::string name = ns + line.substr(p1 + 1);
             TRACE_LOG(LogLevel::INFO, "PURGETRASH " + name);
+            TRACE_REC(TraceOp::Purge, name);
 
-            std::string path = DATA_DIR + "/.trash/" + name;
+            std::string path = trash_path(name);
             std::error_code ec;
-            fs::remove(path, ec);
+            if (g_packed.contains(SegmentStore::Trash, name)) {
+                if (!g_packed.erase(SegmentStore::Trash, name)) ec = std::make_error_code(std::errc::io_error);
+            } else {
+                fs::remove(path, ec);
+            }
             if (ec) {
                 TRACE_LOG(LogLevel::ERR, "Failed to purge: " + ec.message());
                 send_all(cs, "ERR\n", 4);
@@ -557,6 +1809,53 @@ static void handle_client(SOCKET cs) {
                 TRACE_LOG(LogLevel::INFO, "🧹 Permanently deleted: " + name);
                 send_all(cs, "OK\n", 3);
             }
+        } else if (cmd == "PURGE") {
+            std::string name = ns + line.substr(p1 + 1);
+            TRACE_LOG(LogLevel::WARN, "PURGE " + name);
+            TRACE_REC(TraceOp::PurgeLive, name);
+            bool purging_current = (name == current_name);
+            if (purging_current && fd >= 0 && fd != PACKED_FD) { _close(fd); fd = -1; }
+            bool ok = purge_live_file(name, trace_id);
+            if (purging_current) {
+                current_name = ns + DEFAULT_FN;
+                current_path = path_for(current_name);
+                fd = open_rw_create(current_path);
+            }
+            send_all(cs, ok ? "OK\n" : "ERR\n", ok ? 3 : 4);
+
+        } else if (cmd == "GETTRASH") {
+            std::string name = ns + line.substr(p1 + 1);
+            TRACE_LOG(LogLevel::INFO, "GETTRASH " + name);
+            InflightGuard budget(client, IO_CHUNK_BYTES);
+            if (!budget) {
+                TRACE_LOG(LogLevel::WARN, "BUSY: in-flight budget exhausted for " + client);
+                send_all(cs, "BUSY\n", 5);
+                continue;
+            }
+            if (!send_trash_entry(cs, name)) break;
+
+        } else if (cmd == "PUTTRASH") {
+            // PUTTRASH <name> <len>: the name may contain spaces, the length is last
+            size_t last = line.rfind(' ');
+            long long len = 0;
+            if (p1 == std::string::npos || last <= p1 || !parse_num(line.substr(last + 1), len) || len < 0) {
+                TRACE_LOG(LogLevel::ERR, "Malformed PUTTRASH: " + line);
+                send_all(cs, "ERR\n", 4);
+                break;
+            }
+            std::string plain = line.substr(p1 + 1, last - p1 - 1);
+            TRACE_LOG(LogLevel::INFO, "PUTTRASH " + ns + plain + " len=" + std::to_string(len));
+            InflightGuard budget(client, std::min(len, IO_CHUNK_BYTES));
+            if (!plain_name(plain) || !budget) {
+                if (!reject_body(cs, len, budget ? "ERR\n" : "BUSY\n")) break;
+                continue;
+            }
+            std::string stored;
+            if (!recv_trash_entry(cs, ns + plain, len, stored)) break;
+            if (stored.empty()) { send_all(cs, "ERR\n", 4); continue; }
+            std::string hdr = "OK " + stored.substr(ns.size()) + "\n";
+            send_all(cs, hdr.c_str(), (int)hdr.size());
+
         } else {
             TRACE_LOG(LogLevel::ERR, "Unknown command: " + cmd);
             send_all(cs, "ERR\n", 4);
@@ -569,9 +1868,45 @@ static void handle_client(SOCKET cs) {
 }
 
 
+static void shed(const PendingConn& c) {
+    auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - c.since).count();
+    LOGW("⛔ Shedding connection from " + c.client + " after " + std::to_string(waited) + " ms in queue");
+    send_all(c.cs, "BUSY\n", 5);
+    closesocket(c.cs);
+}
+
+static void worker_loop() {
+    while (true) {
+        PendingConn c = g_admission.next();
+        // the sweeper runs every quarter timeout, so a connection can be a little late
+        if (std::chrono::steady_clock::now() - c.since > std::chrono::milliseconds(QUEUE_TIMEOUT_MS)) shed(c);
+        else handle_client(c.cs, c.client);
+        g_admission.conn_done(c.client);
+    }
+}
+
+// sheds queued connections on time even while every worker is busy
+static void queue_sweeper() {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(QUEUE_TIMEOUT_MS / 4));
+        for (auto& c : g_admission.expire()) shed(c);
+    }
+}
+
+
 int main(int argc, char* argv[]) {
+    int port = SERVER_PORT;
     if (argc > 1) DATA_DIR = argv[1];
+    if (argc > 2) port = std::stoi(argv[2]);   // shards run side by side behind the router
     set_data_dir_from_env();
+    load_tenant_weights_from_env();
+    load_cache_budget_from_env();
+    start_packed_store_from_env();
+    open_trace_from_env();
+    start_autosize_from_env();
+    const char* verify = std::getenv("NFS_VERIFY");
+    g_verify_reads = verify && *verify == '1';
+    if (g_verify_reads) LOGI("🧮 Verifying block checksums on cache fill");
 
     WSADATA wsa;
     if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) { std::cerr << "WSAStartup failed\n"; return 1; }
@@ -581,19 +1916,34 @@ int main(int argc, char* argv[]) {
 
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
-    addr.sin_port = htons(SERVER_PORT);
+    addr.sin_port = htons(port);
     inet_pton(AF_INET, SERVER_ADDR.c_str(), &addr.sin_addr);
 
     if (bind(s, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) { std::cerr << "bind() failed\n"; return 1; }
     if (listen(s, SOMAXCONN) == SOCKET_ERROR) { std::cerr << "listen() failed\n"; return 1; }
 
-    LOGI("🚀 Server started on " + SERVER_ADDR + ":" + std::to_string(SERVER_PORT));
+    LOGI("🚀 Server started on " + SERVER_ADDR + ":" + std::to_string(port));
     LOGI("📂 Data directory: " + DATA_DIR);
 
+    for (int i = 0; i < WORKER_THREADS; ++i) std::thread(worker_loop).detach();
+    std::thread(queue_sweeper).detach();
+
     while (true) {
-        SOCKET cs = accept(s, nullptr, nullptr);
+        sockaddr_in peer{};
+        socklen_t plen = sizeof(peer);
+        SOCKET cs = accept(s, (sockaddr*)&peer, &plen);
         if (cs == INVALID_SOCKET) continue;
-        std::thread(handle_client, cs).detach();
+
+        DWORD idle = IDLE_TIMEOUT_MS;
+        setsockopt(cs, SOL_SOCKET, SO_RCVTIMEO, (const char*)&idle, sizeof(idle));
+
+        char ip[INET_ADDRSTRLEN] = "?";
+        inet_ntop(AF_INET, &peer.sin_addr, ip, sizeof(ip));
+        if (!g_admission.enqueue(PendingConn{ cs, ip, std::chrono::steady_clock::now() })) {
+            LOGW(std::string("⛔ Accept queue full, rejecting ") + ip);
+            send_all(cs, "BUSY\n", 5);
+            closesocket(cs);
+        }
     }
     return 0;
 }
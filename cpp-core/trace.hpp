@@ -0,0 +1,198 @@
+#pragma once
+// Compact binary request trace: written by the server when NFS_TRACE_FILE is set,
+// read back by the replay tool.
+//
+// File layout: "NFSTRC1\n" followed by records
+//   'S' u32 id u16 len <len bytes>                        string table entry
+//   'R' u64 ts_us u32 trace u32 file u8 op i64 off i64 len  one request
+// Strings (file names, trace ids) are written once and referenced by id afterwards.
+// A connection that sent TENANT starts with a TENANT record whose file is the
+// tenant id; the names of its later records carry the "tenants/<id>/" prefix.
+// Timestamps come from a steady clock and only their differences mean anything;
+// they are taken under the writer's lock, so they never go backwards in a file.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+static const char   TRACE_MAGIC[8] = { 'N', 'F', 'S', 'T', 'R', 'C', '1', '\n' };
+static const size_t TRACE_FLUSH_BYTES = 64 * 1024;
+static const long long TRACE_FLUSH_US = 1000000;
+
+// (mixed case: DELETE is a macro once <windows.h> is in)
+enum class TraceOp : uint8_t {
+    Open = 1, Read, Write, Stat, List, Delete, Trash, Restore, Purge, Sigs, Delta, ListTrash, Tenant,
+    PurgeLive   // PURGE of a live file; Purge is PURGETRASH
+};
+
+static inline const char* trace_op_name(TraceOp op) {
+    switch (op) {
+        case TraceOp::Open:      return "OPEN";
+        case TraceOp::Read:      return "READ";
+        case TraceOp::Write:     return "WRITE";
+        case TraceOp::Stat:      return "STAT";
+        case TraceOp::List:      return "LIST";
+        case TraceOp::Delete:    return "DELETE";
+        case TraceOp::Trash:     return "TRASH";
+        case TraceOp::Restore:   return "RESTORE";
+        case TraceOp::Purge:     return "PURGETRASH";
+        case TraceOp::Sigs:      return "SIGS";
+        case TraceOp::Delta:     return "DELTA";
+        case TraceOp::ListTrash: return "LISTTRASH";
+        case TraceOp::Tenant:    return "TENANT";
+        case TraceOp::PurgeLive: return "PURGE";
+        default: return "?";
+    }
+}
+
+struct TraceRecord {
+    uint64_t ts_us = 0;     // steady clock, microseconds
+    uint32_t trace = 0;     // string id of the connection's trace id
+    uint32_t file = 0;      // string id of the file name
+    TraceOp  op = TraceOp::Read;
+    int64_t  off = 0;
+    int64_t  len = 0;
+};
+
+static inline uint64_t trace_now_us() {
+    using namespace std::chrono;
+    return (uint64_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static inline void trace_put(std::string& out, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) out.push_back((char)((v >> (8 * i)) & 0xFF));
+}
+
+static inline uint64_t trace_get(const unsigned char* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+// Thread-safe, buffered trace writer. Records are flushed in 64 KB batches or once a second.
+class TraceWriter {
+    FILE* f_ = nullptr;
+    mutable std::mutex mtx_;
+    std::unordered_map<std::string, uint32_t> ids_;
+    std::string buf_;
+    uint64_t last_flush_us_ = 0;
+
+    uint32_t intern(const std::string& s) {
+        auto it = ids_.find(s);
+        if (it != ids_.end()) return it->second;
+        uint32_t id = (uint32_t)ids_.size();
+        ids_.emplace(s, id);
+        size_t n = std::min<size_t>(s.size(), 0xFFFF);
+        buf_.push_back('S');
+        trace_put(buf_, id, 4);
+        trace_put(buf_, n, 2);
+        buf_.append(s, 0, n);
+        return id;
+    }
+
+    void flush_locked() {
+        if (!f_ || buf_.empty()) return;
+        fwrite(buf_.data(), 1, buf_.size(), f_);
+        fflush(f_);
+        buf_.clear();
+    }
+public:
+    ~TraceWriter() { close(); }
+
+    bool open(const std::string& path) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        f_ = fopen(path.c_str(), "wb");
+        if (!f_) return false;
+        fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), f_);
+        last_flush_us_ = trace_now_us();
+        return true;
+    }
+
+    bool enabled() const {
+        std::lock_guard<std::mutex> lk(mtx_);
+        return f_ != nullptr;
+    }
+
+    void record(const std::string& trace, const std::string& file, TraceOp op, long long off, long long len) {
+        std::lock_guard<std::mutex> lk(mtx_);
+        if (!f_) return;
+        uint64_t now = trace_now_us();
+        uint32_t t = intern(trace), fn = intern(file);
+        buf_.push_back('R');
+        trace_put(buf_, now, 8);
+        trace_put(buf_, t, 4);
+        trace_put(buf_, fn, 4);
+        buf_.push_back((char)op);
+        trace_put(buf_, (uint64_t)off, 8);
+        trace_put(buf_, (uint64_t)len, 8);
+        if (buf_.size() >= TRACE_FLUSH_BYTES || now - last_flush_us_ >= (uint64_t)TRACE_FLUSH_US) {
+            flush_locked();
+            last_flush_us_ = now;
+        }
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lk(mtx_);
+        flush_locked();
+        if (f_) fclose(f_);
+        f_ = nullptr;
+    }
+};
+
+// Loads a whole trace; string ids index into `names`.
+struct Trace {
+    std::vector<std::string> names;
+    std::vector<TraceRecord> records;
+
+    const std::string& name(uint32_t id) const {
+        static const std::string empty;
+        return id < names.size() ? names[id] : empty;
+    }
+
+    bool load(const std::string& path, std::string& err) {
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f) { err = "cannot open " + path; return false; }
+        std::vector<unsigned char> data;
+        unsigned char chunk[1 << 16];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.insert(data.end(), chunk, chunk + n);
+        fclose(f);
+
+        if (data.size() < sizeof(TRACE_MAGIC) ||
+            std::string((const char*)data.data(), sizeof(TRACE_MAGIC)) != std::string(TRACE_MAGIC, sizeof(TRACE_MAGIC))) {
+            err = "not a trace file";
+            return false;
+        }
+        size_t i = sizeof(TRACE_MAGIC);
+        while (i < data.size()) {
+            unsigned char tag = data[i++];
+            if (tag == 'S' && i + 6 <= data.size()) {
+                uint32_t id = (uint32_t)trace_get(&data[i], 4);
+                size_t len = (size_t)trace_get(&data[i + 4], 2);
+                i += 6;
+                if (i + len > data.size()) break;
+                if (names.size() <= id) names.resize(id + 1);
+                names[id].assign((const char*)&data[i], len);
+                i += len;
+            } else if (tag == 'R' && i + 33 <= data.size()) {
+                TraceRecord r;
+                r.ts_us = trace_get(&data[i], 8);
+                r.trace = (uint32_t)trace_get(&data[i + 8], 4);
+                r.file  = (uint32_t)trace_get(&data[i + 12], 4);
+                r.op    = (TraceOp)data[i + 16];
+                r.off   = (int64_t)trace_get(&data[i + 17], 8);
+                r.len   = (int64_t)trace_get(&data[i + 25], 8);
+                records.push_back(r);
+                i += 33;
+            } else {
+                break;  // truncated tail of a trace that was still being written
+            }
+        }
+        return true;
+    }
+};